@@ -0,0 +1,133 @@
+#ifndef COWPHYS_BENCH_H
+#define COWPHYS_BENCH_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "CowPhys/PhysWorld.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+namespace bench {
+
+struct Settings {
+    int ticks = 300;
+    int threads = 1;
+    double scale = 1;
+    std::string only;
+    std::string broadPhase = "sap";
+};
+
+// One line of the report, extra holds scenario specific numbers
+struct Result {
+    std::string name;
+    size_t bodies = 0;
+    int ticks = 0;
+    double msPerTick = 0;
+    double msMaxTick = 0;
+    double pairsPerTick = 0;
+    size_t contacts = 0;
+    size_t sleeping = 0;
+    long peakRssKb = 0;
+    uint64_t hash = 0;
+    // set by scenarios checking a guarantee of the engine, the bench exits with an error
+    bool failed = false;
+    std::vector<std::pair<std::string, double>> extra;
+};
+
+class Timer {
+
+public:
+
+    Timer() : mStart(std::chrono::steady_clock::now()) {
+    }
+
+    double elapsedMs() const {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - mStart).count();
+    }
+
+private:
+
+    std::chrono::steady_clock::time_point mStart;
+
+};
+
+// Linux can reset the peak resident size so every scenario gets its own, elsewhere the peak of the
+// whole process is reported
+inline void resetPeakMemory() {
+    std::ofstream clearRefs("/proc/self/clear_refs");
+    if (clearRefs) {
+        clearRefs << "5";
+    }
+}
+
+inline long peakMemoryKb() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) {
+            return std::stol(line.substr(6));
+        }
+    }
+#if defined(__unix__) || defined(__APPLE__)
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return 0;
+#endif
+}
+
+// Hash of every DynBody transform, equal hashes mean the scenario simulated the same thing
+inline uint64_t hashWorld(cp::PhysWorld &world) {
+    uint64_t hash = 1469598103934665603ull;
+    auto mix = [&hash](int64_t value) {
+        hash = (hash ^ static_cast<uint64_t>(value)) * 1099511628211ull;
+    };
+    for (auto body: world.getDynBodies()) {
+        auto pos = body->getPos();
+        auto rotation = body->getRotation();
+        mix(pos.x);
+        mix(pos.y);
+        mix(pos.z);
+        mix(rotation.x);
+        mix(rotation.y);
+        mix(rotation.z);
+    }
+    return hash;
+}
+
+inline void printJson(const Settings &settings, const std::vector<Result> &results) {
+    std::printf("{\n  \"threads\": %d,\n  \"scale\": %g,\n  \"broadphase\": \"%s\",\n  \"scenarios\": [\n",
+                settings.threads, settings.scale, settings.broadPhase.c_str());
+    for (size_t i = 0; i < results.size(); ++i) {
+        auto &result = results[i];
+        std::printf("    {\"name\": \"%s\", \"bodies\": %zu, \"ticks\": %d, \"ms_per_tick\": %.4f, "
+                    "\"ms_max_tick\": %.4f, \"pairs_per_tick\": %.1f, \"contacts\": %zu, \"sleeping\": %zu, "
+                    "\"peak_rss_kb\": %ld, \"hash\": \"%016llx\", \"failed\": %s",
+                    result.name.c_str(), result.bodies, result.ticks, result.msPerTick, result.msMaxTick,
+                    result.pairsPerTick, result.contacts, result.sleeping, result.peakRssKb,
+                    static_cast<unsigned long long>(result.hash), result.failed ? "true" : "false");
+        for (auto &extra: result.extra) {
+            std::printf(", \"%s\": %.4f", extra.first.c_str(), extra.second);
+        }
+        std::printf("}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    std::printf("  ]\n}\n");
+}
+
+}
+
+#endif //COWPHYS_BENCH_H
@@ -0,0 +1,489 @@
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include "Bench.h"
+#include "CowPhys/ShardedWorld.h"
+#include "CowPhys/shape/ShapeRegistry.h"
+#include "CowPhys/serial/Replication.h"
+
+// Headless scenarios stepping a PhysWorld and printing one JSON report, so changes to the engine can
+// be compared run to run. Every scenario is seeded, its hash only changes when the simulation does.
+
+namespace bench {
+
+using Setup = std::function<void(cp::PhysWorld &, cp::ShapeRegistry &)>;
+using PerTick = std::function<void(cp::PhysWorld &, int)>;
+
+static void setBroadPhase(cp::PhysWorld &world, const Settings &settings) {
+    if (settings.broadPhase == "tree") {
+        world.setBroadPhaseType(cp::BroadPhaseType::DynamicTree);
+    } else if (settings.broadPhase == "brute") {
+        world.setBroadPhaseType(cp::BroadPhaseType::BruteForce);
+    }
+}
+
+static Result runWorld(const std::string &name, const Settings &settings, const Setup &setup,
+                       const PerTick &perTick = PerTick()) {
+    resetPeakMemory();
+
+    Result result;
+    {
+        cp::ShapeRegistry shapes;
+        cp::PhysWorld world;
+        world.setThreadCount(settings.threads);
+        setBroadPhase(world, settings);
+        setup(world, shapes);
+
+        size_t pairs = 0;
+        double total = 0;
+        cp::WorldStats phases;
+        for (int tick = 0; tick < settings.ticks; ++tick) {
+            Timer timer;
+            world.applyForceToAllDynBodies(cp::Vec3U(0, -8, 0));
+            world.update();
+            if (perTick) {
+                perTick(world, tick);
+            }
+            double elapsed = timer.elapsedMs();
+            total += elapsed;
+            result.msMaxTick = std::max(result.msMaxTick, elapsed);
+            pairs += world.getPairCount();
+
+            auto stats = world.getStats();
+            phases.integrateMs += stats.integrateMs;
+            phases.broadPhaseMs += stats.broadPhaseMs;
+            phases.narrowPhaseMs += stats.narrowPhaseMs;
+            phases.solveMs += stats.contactsMs + stats.islandsMs + stats.solveMs;
+            phases.sphereTests += stats.sphereTests;
+        }
+
+        result.name = name;
+        result.bodies = world.getDynBodies().size() + world.getStaticBodies().size();
+        result.ticks = settings.ticks;
+        result.msPerTick = settings.ticks > 0 ? total / settings.ticks : 0;
+        result.pairsPerTick = settings.ticks > 0 ? static_cast<double>(pairs) / settings.ticks : 0;
+        result.contacts = world.getContactCount();
+        for (auto body: world.getDynBodies()) {
+            result.sleeping += body->isSleeping() ? 1 : 0;
+        }
+        if (settings.ticks > 0 && COWPHYS_PROFILING) {
+            result.extra.emplace_back("ms_integrate", phases.integrateMs / settings.ticks);
+            result.extra.emplace_back("ms_broadphase", phases.broadPhaseMs / settings.ticks);
+            result.extra.emplace_back("ms_narrowphase", phases.narrowPhaseMs / settings.ticks);
+            result.extra.emplace_back("ms_resolution", phases.solveMs / settings.ticks);
+            result.extra.emplace_back("sphere_tests_per_tick",
+                                      static_cast<double>(phases.sphereTests) / settings.ticks);
+        }
+        result.hash = hashWorld(world);
+        result.peakRssKb = peakMemoryKb();
+    }
+    return result;
+}
+
+static int scaled(const Settings &settings, int count) {
+    return std::max(1, static_cast<int>(count * settings.scale));
+}
+
+// A box of half size 50 is made of spheres reaching 100 from its center, as far as the top of the
+// floors reaches above the origin. Piles leave a small gap so every box spawns without overlapping,
+// boxes turned around y reach up to 121 sideways and need the wider spacing.
+static constexpr cp::Unit BoxSpacing = 210;
+static constexpr cp::Unit TurnedBoxSpacing = 250;
+static constexpr cp::Unit BoxFloorHeight = 210;
+
+// Boxes dropped in a loose grid on a ground box, they land, settle and fall asleep
+static Result fallingBoxes(const Settings &settings) {
+    return runWorld("falling_boxes", settings, [&settings](cp::PhysWorld &world, cp::ShapeRegistry &shapes) {
+        world.createStaticBody(shapes.getBox(20000, 50, 20000), cp::Vec3U());
+        auto box = shapes.getBox(50, 50, 50);
+        int count = scaled(settings, 2000);
+        int side = static_cast<int>(std::ceil(std::sqrt(count / 4.0)));
+        for (int i = 0; i < count; ++i) {
+            auto layer = i / (side * side);
+            auto cell = i % (side * side);
+            cp::Vec3U pos((cell % side - side / 2) * 250, 300 + layer * 250, (cell / side - side / 2) * 250);
+            world.createDynBody(box, pos)->setRotation(cp::Vec3Small(0, (i * 37) % 512, 0));
+        }
+    });
+}
+
+// Boxes stacked ten high in columns a small gap apart, most of them rest on and carry others
+static Result densePile(const Settings &settings) {
+    return runWorld("dense_pile", settings, [&settings](cp::PhysWorld &world, cp::ShapeRegistry &shapes) {
+        world.createStaticBody(shapes.getBox(5000, 50, 5000), cp::Vec3U());
+        auto box = shapes.getBox(50, 50, 50);
+        int count = scaled(settings, 1000);
+        for (int i = 0; i < count; ++i) {
+            cp::Vec3U pos((i % 10 - 5) * BoxSpacing, BoxFloorHeight + (i / 100) * BoxSpacing,
+                          (i / 10 % 10 - 5) * BoxSpacing);
+            world.createDynBody(box, pos);
+        }
+    });
+}
+
+// Many bodies drifting far apart without gravity pulling them together, mostly broadphase work
+static Result sparseWorld(const Settings &settings) {
+    std::mt19937 random(7);
+    return runWorld("sparse_world", settings, [&settings, &random](cp::PhysWorld &world, cp::ShapeRegistry &shapes) {
+        world.setSleepTicks(0);
+        auto box = shapes.getBox(20, 20, 20);
+        int count = scaled(settings, 10000);
+        for (int i = 0; i < count; ++i) {
+            cp::Vec3U pos(static_cast<cp::Unit>(random() % 2000000) - 1000000,
+                          static_cast<cp::Unit>(random() % 2000000) - 1000000,
+                          static_cast<cp::Unit>(random() % 2000000) - 1000000);
+            auto body = world.createDynBody(box, pos);
+            body->setVelocity(cp::Vec3U(static_cast<cp::Unit>(random() % 41) - 20,
+                                        static_cast<cp::Unit>(random() % 41) - 20,
+                                        static_cast<cp::Unit>(random() % 41) - 20));
+        }
+    }, [](cp::PhysWorld &world, int) {
+        // cancel the gravity runWorld applies so the bodies keep drifting
+        world.applyForceToAllDynBodies(cp::Vec3U(0, 8, 0));
+    });
+}
+
+// Compound bodies made of several boxes, landing on a mesh ground so the triangle path runs too
+static Result compounds(const Settings &settings) {
+    return runWorld("compounds", settings, [&settings](cp::PhysWorld &world, cp::ShapeRegistry &shapes) {
+        std::vector<cp::TriangleU> triangles;
+        const int cells = 64;
+        const cp::Unit cellSize = 250;
+        for (int x = 0; x < cells; ++x) {
+            for (int z = 0; z < cells; ++z) {
+                cp::Unit x0 = (x - cells / 2) * cellSize, x1 = x0 + cellSize;
+                cp::Unit z0 = (z - cells / 2) * cellSize, z1 = z0 + cellSize;
+                triangles.emplace_back(cp::Vec3U(x0, 0, z0), cp::Vec3U(x1, 0, z0), cp::Vec3U(x1, 0, z1));
+                triangles.emplace_back(cp::Vec3U(x1, 0, z1), cp::Vec3U(x0, 0, z1), cp::Vec3U(x0, 0, z0));
+            }
+        }
+        world.createStaticBody(shapes.getMesh(triangles), cp::Vec3U());
+
+        auto part = shapes.getBox(25, 25, 25);
+        auto comp = shapes.getComp({{part, cp::Vec3U()}, {part, cp::Vec3U(60, 0, 0)},
+                                    {part, cp::Vec3U(0, 60, 0)}, {part, cp::Vec3U(0, 0, 60)}});
+        int count = scaled(settings, 500);
+        int side = static_cast<int>(std::ceil(std::sqrt(count / 2.0)));
+        for (int i = 0; i < count; ++i) {
+            auto layer = i / (side * side);
+            auto cell = i % (side * side);
+            cp::Vec3U pos((cell % side - side / 2) * 300, 200 + layer * 300, (cell / side - side / 2) * 300);
+            world.createDynBody(comp, pos)->setRotation(cp::Vec3Small((i * 13) % 512, (i * 29) % 512, 0));
+        }
+    });
+}
+
+// Settled boxes under thousands of rays per tick cast through raycastBatch
+static Result raycastStorm(const Settings &settings) {
+    std::vector<cp::RaycastQuery> queries;
+    std::vector<cp::WorldRaycast> results;
+    double rayMs = 0;
+    size_t hits = 0;
+    auto result = runWorld("raycast_storm", settings, [&settings, &queries](cp::PhysWorld &world,
+                                                                           cp::ShapeRegistry &shapes) {
+        world.createStaticBody(shapes.getBox(20000, 50, 20000), cp::Vec3U());
+        auto box = shapes.getBox(50, 50, 50);
+        int count = scaled(settings, 1000);
+        int side = static_cast<int>(std::ceil(std::sqrt(count)));
+        for (int i = 0; i < count; ++i) {
+            world.createDynBody(box, cp::Vec3U((i % side - side / 2) * 300, BoxFloorHeight,
+                                               (i / side - side / 2) * 300));
+        }
+
+        std::mt19937 random(11);
+        queries.resize(scaled(settings, 10000));
+        for (auto &query: queries) {
+            query.pos = cp::Vec3U(static_cast<cp::Unit>(random() % 20000) - 10000, 2000,
+                                  static_cast<cp::Unit>(random() % 20000) - 10000);
+            query.dir = cp::Vec3U(static_cast<cp::Unit>(random() % 201) - 100, -1000,
+                                  static_cast<cp::Unit>(random() % 201) - 100);
+        }
+    }, [&](cp::PhysWorld &world, int) {
+        Timer timer;
+        world.raycastBatch(queries, results);
+        rayMs += timer.elapsedMs();
+        for (auto &ray: results) {
+            hits += ray.body != nullptr ? 1 : 0;
+        }
+    });
+
+    double rays = static_cast<double>(queries.size()) * settings.ticks;
+    result.extra.emplace_back("rays_per_tick", static_cast<double>(queries.size()));
+    result.extra.emplace_back("ms_rays_per_tick", settings.ticks > 0 ? rayMs / settings.ticks : 0);
+    result.extra.emplace_back("hit_ratio", rays > 0 ? hits / rays : 0);
+    return result;
+}
+
+// Moving bodies captured and delta encoded against the last acknowledged snapshot every tick
+static Result replication(const Settings &settings) {
+    cp::ReplicationSnapshot baseline, current;
+    std::vector<uint8_t> packet;
+    double encodeMs = 0;
+    size_t bytes = 0;
+    auto result = runWorld("replication", settings, [&settings](cp::PhysWorld &world, cp::ShapeRegistry &shapes) {
+        world.setSleepTicks(0);
+        std::mt19937 random(5);
+        auto box = shapes.getBox(10, 10, 10);
+        int count = scaled(settings, 10000);
+        for (int i = 0; i < count; ++i) {
+            auto body = world.createDynBody(box, cp::Vec3U((i % 100) * 1000, (i / 100) * 1000, 0));
+            body->setVelocity(cp::Vec3U(static_cast<cp::Unit>(random() % 200) - 100,
+                                        static_cast<cp::Unit>(random() % 200) - 100,
+                                        static_cast<cp::Unit>(random() % 200) - 100));
+            body->setAngularVelocity(cp::Vec3U(static_cast<cp::Unit>(random() % 40) - 20, 0,
+                                               static_cast<cp::Unit>(random() % 40) - 20));
+        }
+    }, [&](cp::PhysWorld &world, int tick) {
+        world.applyForceToAllDynBodies(cp::Vec3U(0, 8, 0));
+        current.capture(world);
+        packet.clear();
+        Timer timer;
+        cp::ReplicationEncoder::encode(baseline, current, packet);
+        encodeMs += timer.elapsedMs();
+        // the first packet is a full one, only the deltas after it are measured
+        if (tick > 0) {
+            bytes += packet.size();
+        }
+        // the client acknowledges every other packet
+        if (tick % 2 == 0) {
+            baseline = current;
+        }
+    });
+
+    int deltas = std::max(1, settings.ticks - 1);
+    result.extra.emplace_back("bytes_per_tick", static_cast<double>(bytes) / deltas);
+    result.extra.emplace_back("bytes_per_body", result.bodies > 0 ? static_cast<double>(bytes) / deltas / result.bodies : 0);
+    result.extra.emplace_back("ms_encode_per_tick", settings.ticks > 0 ? encodeMs / settings.ticks : 0);
+    return result;
+}
+
+// A settling pile saved every tick and regularly rolled back eight ticks then replayed, the way a
+// server rewinds for a late input. Every replayed tick has to hash like the first time, the
+// scenario fails on any mismatch.
+static Result rollback(const Settings &settings) {
+    const int rollbackTicks = 8;
+    const int rollbackInterval = 10;
+    std::vector<std::vector<uint8_t>> states(rollbackTicks + 1);
+    std::vector<uint64_t> hashes(rollbackTicks + 1);
+    size_t rollbacks = 0;
+    size_t mismatches = 0;
+    double loadMs = 0;
+    auto result = runWorld("rollback", settings, [&settings](cp::PhysWorld &world, cp::ShapeRegistry &shapes) {
+        world.createStaticBody(shapes.getBox(5000, 50, 5000), cp::Vec3U());
+        auto box = shapes.getBox(50, 50, 50);
+        int count = scaled(settings, 1000);
+        for (int i = 0; i < count; ++i) {
+            cp::Vec3U pos((i % 10 - 5) * TurnedBoxSpacing, BoxFloorHeight + (i / 100) * BoxSpacing,
+                          (i / 10 % 10 - 5) * TurnedBoxSpacing);
+            world.createDynBody(box, pos)->setRotation(cp::Vec3Small(0, (i * 37) % 512, 0));
+        }
+    }, [&](cp::PhysWorld &world, int tick) {
+        // the state and hash after every tick are kept, indexed by tick
+        auto slot = static_cast<size_t>(tick) % states.size();
+        world.saveState(states[slot]);
+        hashes[slot] = hashWorld(world);
+        if (tick < rollbackTicks || tick % rollbackInterval != 0) {
+            return;
+        }
+
+        Timer timer;
+        if (!world.loadState(states[(tick - rollbackTicks) % states.size()])) {
+            ++mismatches;
+            return;
+        }
+        loadMs += timer.elapsedMs();
+        ++rollbacks;
+        for (int replayed = tick - rollbackTicks + 1; replayed <= tick; ++replayed) {
+            world.applyForceToAllDynBodies(cp::Vec3U(0, -8, 0));
+            world.update();
+            if (hashWorld(world) != hashes[static_cast<size_t>(replayed) % states.size()]) {
+                ++mismatches;
+            }
+        }
+    });
+
+    result.failed = mismatches > 0;
+    result.extra.emplace_back("rollbacks", static_cast<double>(rollbacks));
+    result.extra.emplace_back("mismatches", static_cast<double>(mismatches));
+    result.extra.emplace_back("state_bytes", static_cast<double>(states.front().size()));
+    result.extra.emplace_back("ms_load", rollbacks > 0 ? loadMs / rollbacks : 0);
+    return result;
+}
+
+// A pile straddling the middle of the world and boxes sliding over region borders, stepped by a
+// ShardedWorld cut into a grid of the given size with one thread per --threads. The hash does not
+// depend on the thread count but does on the grid, bodies touching across a border push against
+// ghosts and the ones handed off start their contacts over.
+static Result sharded(const Settings &settings, uint32_t grid) {
+    const cp::Unit halfWorld = 8000;
+    cp::ShardedWorldSettings worldSettings;
+    worldSettings.origin = cp::Vec3U(-halfWorld, 0, -halfWorld);
+    worldSettings.regionSize = 2 * halfWorld / grid;
+    worldSettings.columns = grid;
+    worldSettings.rows = grid;
+    worldSettings.ghostMargin = 500;
+    worldSettings.threadCount = settings.threads;
+
+    resetPeakMemory();
+    Result result;
+    {
+        cp::ShapeRegistry shapes;
+        cp::ShardedWorld world(worldSettings);
+        for (size_t i = 0; i < world.getShardCount(); ++i) {
+            setBroadPhase(world.getShard(i), settings);
+        }
+
+        world.createStaticBody(shapes.getBox(halfWorld + 1000, 50, halfWorld + 1000), cp::Vec3U());
+        auto box = shapes.getBox(50, 50, 50);
+        std::vector<cp::BodyHandle> handles;
+        int pile = scaled(settings, 400);
+        for (int i = 0; i < pile; ++i) {
+            cp::Vec3U pos((i % 10 - 5) * BoxSpacing, BoxFloorHeight + (i / 100) * BoxSpacing,
+                          (i / 10 % 10 - 5) * BoxSpacing);
+            handles.push_back(world.createDynBody(box, pos));
+        }
+        // sliders start on a grid around the pile, at most one per cell
+        const int sliderColumns = 20;
+        const cp::Unit sliderSpacing = 700;
+        std::mt19937 random(3);
+        int sliders = scaled(settings, 200);
+        for (int cell = 0, i = 0; i < sliders && cell < sliderColumns * sliderColumns; ++cell) {
+            cp::Vec3U pos((cell % sliderColumns - sliderColumns / 2) * sliderSpacing + sliderSpacing / 2,
+                          BoxFloorHeight,
+                          (cell / sliderColumns - sliderColumns / 2) * sliderSpacing + sliderSpacing / 2);
+            if (std::abs(pos.x) < 2 * sliderSpacing && std::abs(pos.z) < 2 * sliderSpacing) {
+                continue;
+            }
+            auto handle = world.createDynBody(box, pos);
+            // set once the ghosts may already exist, they have to follow
+            world.getDynBody(handle)->setMass(static_cast<cp::SmallUnit>(i % 3 + 1));
+            world.getDynBody(handle)->setVelocity(cp::Vec3U(static_cast<cp::Unit>(random() % 801) - 400, 0,
+                                                            static_cast<cp::Unit>(random() % 801) - 400));
+            handles.push_back(handle);
+            ++i;
+        }
+
+        size_t pairs = 0;
+        size_t ghosts = 0;
+        double total = 0;
+        for (int tick = 0; tick < settings.ticks; ++tick) {
+            Timer timer;
+            world.applyForceToAllDynBodies(cp::Vec3U(0, -8, 0));
+            world.update();
+            double elapsed = timer.elapsedMs();
+            total += elapsed;
+            result.msMaxTick = std::max(result.msMaxTick, elapsed);
+            for (size_t i = 0; i < world.getShardCount(); ++i) {
+                pairs += world.getShard(i).getPairCount();
+            }
+            ghosts += world.getGhostCount();
+        }
+
+        result.name = "sharded_" + std::to_string(grid) + "x" + std::to_string(grid);
+        result.bodies = world.getDynBodyCount() + 1;
+        result.ticks = settings.ticks;
+        result.msPerTick = settings.ticks > 0 ? total / settings.ticks : 0;
+        result.pairsPerTick = settings.ticks > 0 ? static_cast<double>(pairs) / settings.ticks : 0;
+        for (size_t i = 0; i < world.getShardCount(); ++i) {
+            result.contacts += world.getShard(i).getContactCount();
+        }
+
+        // bodies are hashed by handle, the shard and the index holding them change with every hand off
+        uint64_t hash = 1469598103934665603ull;
+        auto mix = [&hash](int64_t value) {
+            hash = (hash ^ static_cast<uint64_t>(value)) * 1099511628211ull;
+        };
+        for (auto handle: handles) {
+            auto body = world.getDynBody(handle);
+            result.sleeping += body->isSleeping() ? 1 : 0;
+            mix(body->getPos().x);
+            mix(body->getPos().y);
+            mix(body->getPos().z);
+            mix(body->getRotation().x);
+            mix(body->getRotation().y);
+            mix(body->getRotation().z);
+        }
+        result.hash = hash;
+        result.extra.emplace_back("shards", static_cast<double>(world.getShardCount()));
+        result.extra.emplace_back("ghosts_per_tick", settings.ticks > 0 ? static_cast<double>(ghosts) / settings.ticks : 0);
+        result.peakRssKb = peakMemoryKb();
+    }
+    return result;
+}
+
+static Result sharded1x1(const Settings &settings) {
+    return sharded(settings, 1);
+}
+
+static Result sharded2x2(const Settings &settings) {
+    return sharded(settings, 2);
+}
+
+static Result sharded4x4(const Settings &settings) {
+    return sharded(settings, 4);
+}
+
+static void printUsage() {
+    std::fprintf(stderr, "usage: cowphys_bench [--ticks N] [--threads N] [--scale F] [--only NAME[,NAME...]]\n"
+                         "                     [--broadphase sap|tree|brute]\n"
+                         "scenarios: falling_boxes dense_pile sparse_world compounds raycast_storm replication\n"
+                         "           rollback sharded_1x1 sharded_2x2 sharded_4x4\n");
+}
+
+}
+
+int main(int argc, char **argv) {
+    bench::Settings settings;
+    for (int i = 1; i < argc; ++i) {
+        bool hasValue = i + 1 < argc;
+        if (std::strcmp(argv[i], "--ticks") == 0 && hasValue) {
+            settings.ticks = std::max(0, std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "--threads") == 0 && hasValue) {
+            settings.threads = std::max(1, std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "--scale") == 0 && hasValue) {
+            settings.scale = std::max(0.0, std::atof(argv[++i]));
+        } else if (std::strcmp(argv[i], "--only") == 0 && hasValue) {
+            settings.only = argv[++i];
+        } else if (std::strcmp(argv[i], "--broadphase") == 0 && hasValue) {
+            settings.broadPhase = argv[++i];
+        } else {
+            bench::printUsage();
+            return 1;
+        }
+    }
+
+    const std::pair<const char *, bench::Result (*)(const bench::Settings &)> scenarios[] = {
+            {"falling_boxes", bench::fallingBoxes},
+            {"dense_pile",    bench::densePile},
+            {"sparse_world",  bench::sparseWorld},
+            {"compounds",     bench::compounds},
+            {"raycast_storm", bench::raycastStorm},
+            {"replication",   bench::replication},
+            {"rollback",      bench::rollback},
+            {"sharded_1x1",   bench::sharded1x1},
+            {"sharded_2x2",   bench::sharded2x2},
+            {"sharded_4x4",   bench::sharded4x4},
+    };
+
+    std::vector<bench::Result> results;
+    for (auto &scenario: scenarios) {
+        if (!settings.only.empty() && ("," + settings.only + ",").find(std::string(",") + scenario.first + ",") ==
+                                      std::string::npos) {
+            continue;
+        }
+        std::fprintf(stderr, "running %s\n", scenario.first);
+        results.push_back(scenario.second(settings));
+    }
+
+    bench::printJson(settings, results);
+
+    bool failed = false;
+    for (auto &result: results) {
+        if (result.failed) {
+            std::fprintf(stderr, "%s failed\n", result.name.c_str());
+            failed = true;
+        }
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,61 @@
+#ifndef COWPHYS_ARRAYVIEW_H
+#define COWPHYS_ARRAYVIEW_H
+
+#include <cstddef>
+#include <vector>
+
+namespace cp {
+
+// Read only window over contiguous elements owned elsewhere, a vector or a mapped file
+template<class T>
+class ArrayView {
+
+public:
+
+    ArrayView() : mData(nullptr), mSize(0) {
+    }
+
+    ArrayView(const T *data, size_t size) : mData(data), mSize(size) {
+    }
+
+    ArrayView(const std::vector<T> &vector) : mData(vector.data()), mSize(vector.size()) {
+    }
+
+    const T *begin() const {
+        return mData;
+    }
+
+    const T *end() const {
+        return mData + mSize;
+    }
+
+    const T *data() const {
+        return mData;
+    }
+
+    size_t size() const {
+        return mSize;
+    }
+
+    bool empty() const {
+        return mSize == 0;
+    }
+
+    const T &operator[](size_t index) const {
+        return mData[index];
+    }
+
+    const T &front() const {
+        return mData[0];
+    }
+
+private:
+
+    const T *mData;
+    size_t mSize;
+
+};
+
+}
+
+#endif //COWPHYS_ARRAYVIEW_H
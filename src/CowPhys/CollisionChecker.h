@@ -1,7 +1,9 @@
 #ifndef COWPHYS_COLLISIONCHECKER_H
 #define COWPHYS_COLLISIONCHECKER_H
 
+#include <cmath>
 #include <limits>
+#include <utility>
 #include "body/Body.h"
 
 namespace cp {
@@ -11,6 +13,14 @@ struct CollisionInfo {
     Unit depth;
     Vec3U normal;
     Vec3U contact;
+    int32_t leftSphere;
+    int32_t rightSphere;
+};
+
+// Sphere pair that was the deepest one the last time two bodies touched
+struct CollisionHint {
+    int32_t leftSphere;
+    int32_t rightSphere;
 };
 
 class CollisionChecker {
@@ -18,25 +28,105 @@ class CollisionChecker {
 
 public:
 
-    static CollisionInfo checkCollision(Body *left, Body *right) {
+    // With a hint the given sphere pair is tested first, its depth then prunes every node pair that
+    // cannot get deeper. The result is the same with or without a hint.
+    static CollisionInfo checkCollision(Body *left, Body *right, const CollisionHint *hint = nullptr) {
         CollisionInfo info;
         info.collision = false;
         info.depth = std::numeric_limits<Unit>::min();
-        for (auto leftSphere: left->getShape()->getSpheres()) {
-            leftSphere.rotateBy(left->getRotation().to<Unit>());
-            leftSphere.moveBy(left->getPos());
-            for (auto rightSphere: right->getShape()->getSpheres()) {
-                rightSphere.rotateBy(right->getRotation().to<Unit>());
-                rightSphere.moveBy(right->getPos());
-
-                if (leftSphere.collides(rightSphere)) {
-                    Unit depth = leftSphere.penetration(rightSphere);
-                    if (depth > info.depth) {
-                        info.collision = true;
-                        info.depth = depth;
-                        info.contact = rightSphere.getPosition();
-                        info.normal = (rightSphere.getPosition() - leftSphere.getPosition()).normalize();
-                    }
+        info.leftSphere = -1;
+        info.rightSphere = -1;
+
+        if (!left->getWorldAABB().collides(right->getWorldAABB()) ||
+            !boundsOverlap(left->getWorldBoundingSphere(), right->getWorldBoundingSphere())) {
+            return info;
+        }
+
+        auto leftMesh = left->getShape()->asMesh();
+        auto rightMesh = right->getShape()->asMesh();
+        if (leftMesh != nullptr || rightMesh != nullptr) {
+            if (leftMesh != nullptr && rightMesh != nullptr) {
+                return info;
+            }
+            if (rightMesh != nullptr) {
+                checkMeshCollision(left, right, *rightMesh, info);
+                return info;
+            }
+            // computed from the point of view of the spheres, then turned around
+            checkMeshCollision(right, left, *leftMesh, info);
+            info.normal = -info.normal;
+            std::swap(info.leftSphere, info.rightSphere);
+            return info;
+        }
+
+        auto &leftSpheres = left->getWorldSpheres();
+        auto &rightSpheres = right->getWorldSpheres();
+        auto &rightArrays = right->getWorldSphereArrays();
+        auto leftNodes = left->getShape()->getSphereTree().getNodes();
+        auto rightNodes = right->getShape()->getSphereTree().getNodes();
+        auto &leftBounds = left->getWorldNodeBounds();
+        auto &rightBounds = right->getWorldNodeBounds();
+        if (leftNodes.empty() || rightNodes.empty()) {
+            return info;
+        }
+
+        auto record = [&info, &leftSpheres, &rightSpheres](int32_t i, int32_t j, Unit depth) {
+            // equal depths keep the lowest sphere indices so the traversal order never matters
+            if (depth > info.depth ||
+                (depth == info.depth && std::make_pair(i, j) < std::make_pair(info.leftSphere, info.rightSphere))) {
+                auto &leftSphere = leftSpheres[i];
+                auto &rightSphere = rightSpheres[j];
+                info.collision = true;
+                info.depth = depth;
+                info.contact = rightSphere.getPosition();
+                info.normal = (rightSphere.getPosition() - leftSphere.getPosition()).normalize();
+                info.leftSphere = i;
+                info.rightSphere = j;
+            }
+        };
+
+        if (hint != nullptr && hint->leftSphere >= 0 && hint->rightSphere >= 0 &&
+            hint->leftSphere < static_cast<int32_t>(leftSpheres.size()) &&
+            hint->rightSphere < static_cast<int32_t>(rightSpheres.size())) {
+            auto &leftSphere = leftSpheres[hint->leftSphere];
+            auto &rightSphere = rightSpheres[hint->rightSphere];
+            if (leftSphere.collides(rightSphere)) {
+                record(hint->leftSphere, hint->rightSphere, leftSphere.penetration(rightSphere));
+            }
+        }
+
+        // descend both sphere trees at once, only leaves whose bounds overlap compare their spheres
+        std::pair<int32_t, int32_t> stack[(SphereTree::MaxDepth + 1) * 2];
+        int stackSize = 0;
+        stack[stackSize++] = {0, 0};
+        while (stackSize > 0) {
+            auto nodes = stack[--stackSize];
+            auto &leftNode = leftNodes[nodes.first];
+            auto &rightNode = rightNodes[nodes.second];
+            if (!boundsOverlap(leftBounds[nodes.first], rightBounds[nodes.second]) ||
+                (info.collision && maxDepth(leftBounds[nodes.first], rightBounds[nodes.second]) < info.depth)) {
+                continue;
+            }
+
+            bool splitLeft = !leftNode.isLeaf() &&
+                             (rightNode.isLeaf() || leftNode.bounds.getRadius() >= rightNode.bounds.getRadius());
+            if (splitLeft) {
+                stack[stackSize++] = {leftNode.right, nodes.second};
+                stack[stackSize++] = {leftNode.left, nodes.second};
+                continue;
+            }
+            if (!rightNode.isLeaf()) {
+                stack[stackSize++] = {nodes.first, rightNode.right};
+                stack[stackSize++] = {nodes.first, rightNode.left};
+                continue;
+            }
+
+            COWPHYS_PROFILE_COUNT(sphereTests, leftNode.count * rightNode.count);
+            for (int32_t i = leftNode.start; i < leftNode.start + leftNode.count; ++i) {
+                auto &leftSphere = leftSpheres[i];
+                auto hit = SphereKernel::deepest(leftSphere, rightArrays, rightNode.start, rightNode.count);
+                if (hit.index >= 0) {
+                    record(i, hit.index, hit.depth);
                 }
             }
         }
@@ -44,9 +134,264 @@ public:
         return info;
     }
 
+    // Lowers time to the fraction of motion at which the spheres of moving, translated by motion from
+    // motion before their current world position, first touch fixed, which does not move. Spheres
+    // already touching at the start are left to checkCollision. Returns true when time was lowered.
+    static bool sweepCollision(Body *moving, const Vec3U &motion, Body *fixed, double &time) {
+        auto &spheres = moving->getWorldSpheres();
+        auto movingNodes = moving->getShape()->getSphereTree().getNodes();
+        auto &movingBounds = moving->getWorldNodeBounds();
+        if (movingNodes.empty()) {
+            return false;
+        }
+
+        const double delta[3] = {static_cast<double>(motion.x), static_cast<double>(motion.y),
+                                 static_cast<double>(motion.z)};
+        auto mesh = fixed->getShape()->asMesh();
+        if (mesh != nullptr) {
+            return sweepMesh(spheres, motion, delta, fixed, *mesh, time);
+        }
+
+        auto fixedNodes = fixed->getShape()->getSphereTree().getNodes();
+        auto &fixedSpheres = fixed->getWorldSpheres();
+        auto &fixedBounds = fixed->getWorldNodeBounds();
+        if (fixedNodes.empty()) {
+            return false;
+        }
+
+        auto start = [&motion](const SphereU &sphere) {
+            return SphereU(sphere.getPosition() - motion, sphere.getRadius());
+        };
+
+        bool found = false;
+        std::pair<int32_t, int32_t> stack[(SphereTree::MaxDepth + 1) * 2];
+        int stackSize = 0;
+        stack[stackSize++] = {0, 0};
+        while (stackSize > 0) {
+            auto nodes = stack[--stackSize];
+            auto &movingNode = movingNodes[nodes.first];
+            auto &fixedNode = fixedNodes[nodes.second];
+            // bounds already touching at the start give 0, their spheres may still touch later
+            double nodeTime = time;
+            if (!sweepSpheres(start(movingBounds[nodes.first]), delta, fixedBounds[nodes.second], nodeTime, true)) {
+                continue;
+            }
+
+            bool splitMoving = !movingNode.isLeaf() &&
+                               (fixedNode.isLeaf() || movingNode.bounds.getRadius() >= fixedNode.bounds.getRadius());
+            if (splitMoving) {
+                stack[stackSize++] = {movingNode.right, nodes.second};
+                stack[stackSize++] = {movingNode.left, nodes.second};
+                continue;
+            }
+            if (!fixedNode.isLeaf()) {
+                stack[stackSize++] = {nodes.first, fixedNode.right};
+                stack[stackSize++] = {nodes.first, fixedNode.left};
+                continue;
+            }
+
+            COWPHYS_PROFILE_COUNT(sphereTests, movingNode.count * fixedNode.count);
+            for (int32_t i = movingNode.start; i < movingNode.start + movingNode.count; ++i) {
+                auto sphere = start(spheres[i]);
+                for (int32_t j = fixedNode.start; j < fixedNode.start + fixedNode.count; ++j) {
+                    found |= sweepSpheres(sphere, delta, fixedSpheres[j], time, false);
+                }
+            }
+        }
+
+        return found;
+    }
+
 
 private:
 
+    // Lowers time to the first time below it at which a sphere moving by delta touches a fixed one. A
+    // conservative test counts spheres touching at the start as touching at 0, otherwise they are skipped.
+    static bool sweepSpheres(const SphereU &moving, const double delta[3], const SphereU &fixed, double &time,
+                             bool conservative) {
+        auto offset = moving.getPosition() - fixed.getPosition();
+        double position[3] = {static_cast<double>(offset.x), static_cast<double>(offset.y),
+                              static_cast<double>(offset.z)};
+        double radius = static_cast<double>(moving.getRadius()) + static_cast<double>(fixed.getRadius());
+        double c = position[0] * position[0] + position[1] * position[1] + position[2] * position[2] -
+                   radius * radius;
+        if (c <= 0) {
+            if (!conservative) {
+                return false;
+            }
+            time = 0;
+            return true;
+        }
+
+        double a = delta[0] * delta[0] + delta[1] * delta[1] + delta[2] * delta[2];
+        double b = 2 * (position[0] * delta[0] + position[1] * delta[1] + position[2] * delta[2]);
+        double discriminant = b * b - 4 * a * c;
+        if (a == 0 || b >= 0 || discriminant < 0) {
+            return false;
+        }
+
+        double hit = (-b - std::sqrt(discriminant)) / (2 * a);
+        if (hit >= time) {
+            return false;
+        }
+        time = hit;
+        return true;
+    }
+
+    // Casts the center of every sphere against the triangles, a sphere touches where its center is
+    // one radius away from the hit along the motion
+    static bool sweepMesh(const std::vector<SphereU> &spheres, const Vec3U &motion, const double delta[3],
+                          Body *meshBody, const MeshShape &mesh, double &time) {
+        double length = std::sqrt(delta[0] * delta[0] + delta[1] * delta[1] + delta[2] * delta[2]);
+        if (length == 0) {
+            return false;
+        }
+
+        auto &rotation = meshBody->getRotationMatrix();
+        double direction[3];
+        rotation.applyInverse(motion, direction);
+        for (auto &value: direction) {
+            value /= length;
+        }
+
+        bool found = false;
+        for (auto &sphere: spheres) {
+            double start[3];
+            rotation.applyInverse(sphere.getPosition() - motion - meshBody->getPos(), start);
+            auto radius = static_cast<double>(sphere.getRadius());
+            auto t = static_cast<Unit>(std::ceil(time * length + radius));
+            if (!mesh.getTriangleTree().raycast(mesh.getTriangles(), start, direction, t)) {
+                continue;
+            }
+
+            double hit = (static_cast<double>(t) - radius) / length;
+            if (hit > 0 && hit < time) {
+                time = hit;
+                found = true;
+            }
+        }
+        return found;
+    }
+
+    // Deepest contact between the spheres of a body and the triangles of a mesh body, rightSphere
+    // receives the triangle index. Sphere tree and triangle tree are descended together, the spheres
+    // are moved into mesh space rather than the triangles into world space.
+    static void checkMeshCollision(Body *body, Body *meshBody, const MeshShape &mesh, CollisionInfo &info) {
+        auto &spheres = body->getWorldSpheres();
+        auto sphereNodes = body->getShape()->getSphereTree().getNodes();
+        auto &sphereBounds = body->getWorldNodeBounds();
+        auto triangles = mesh.getTriangles();
+        auto triangleNodes = mesh.getTriangleTree().getNodes();
+        if (sphereNodes.empty() || triangleNodes.empty()) {
+            return;
+        }
+
+        auto &rotation = meshBody->getRotationMatrix();
+        auto meshPos = meshBody->getPos();
+        auto toLocal = [&rotation, &meshPos](const Vec3U &point) {
+            return rotation.applyInverse(point - meshPos);
+        };
+
+        double closest[3];
+        Vec3U closestPoint;
+        int32_t bestSphere = -1;
+        auto record = [&](int32_t i, int32_t j, Unit depth, const Vec3U &point) {
+            // equal depths keep the lowest indices so the traversal order never matters
+            if (depth > info.depth ||
+                (depth == info.depth && std::make_pair(i, j) < std::make_pair(info.leftSphere, info.rightSphere))) {
+                info.collision = true;
+                info.depth = depth;
+                info.leftSphere = i;
+                info.rightSphere = j;
+                closestPoint = point;
+                bestSphere = i;
+            }
+        };
+
+        std::pair<int32_t, int32_t> stack[(SphereTree::MaxDepth + TriangleTree::MaxDepth + 2) * 2];
+        int stackSize = 0;
+        stack[stackSize++] = {0, 0};
+        while (stackSize > 0) {
+            auto nodes = stack[--stackSize];
+            auto &sphereNode = sphereNodes[nodes.first];
+            auto &triangleNode = triangleNodes[nodes.second];
+            auto &bounds = sphereBounds[nodes.first];
+            auto radius = static_cast<double>(bounds.getRadius());
+            double distanceSquared = TriangleTree::distanceSquared(triangleNode, toLocal(bounds.getPosition()));
+            // one more for the rounding into mesh space
+            if (distanceSquared >= (radius + 1) * (radius + 1) ||
+                (info.collision && radius + 1 - std::sqrt(distanceSquared) < info.depth)) {
+                continue;
+            }
+
+            auto half = (triangleNode.max - triangleNode.min) / 2;
+            bool splitSpheres = !sphereNode.isLeaf() &&
+                                (triangleNode.isLeaf() || bounds.getRadius() >= std::max(half.x, std::max(half.y, half.z)));
+            if (splitSpheres) {
+                stack[stackSize++] = {sphereNode.right, nodes.second};
+                stack[stackSize++] = {sphereNode.left, nodes.second};
+                continue;
+            }
+            if (!triangleNode.isLeaf()) {
+                stack[stackSize++] = {nodes.first, triangleNode.right};
+                stack[stackSize++] = {nodes.first, triangleNode.left};
+                continue;
+            }
+
+            COWPHYS_PROFILE_COUNT(sphereTests, sphereNode.count * triangleNode.count);
+            for (int32_t i = sphereNode.start; i < sphereNode.start + sphereNode.count; ++i) {
+                auto center = toLocal(spheres[i].getPosition());
+                auto sphereRadius = static_cast<double>(spheres[i].getRadius());
+                for (int32_t j = triangleNode.start; j < triangleNode.start + triangleNode.count; ++j) {
+                    triangles[j].closestPoint(center, closest);
+                    double dx = closest[0] - center.x, dy = closest[1] - center.y, dz = closest[2] - center.z;
+                    double squared = dx * dx + dy * dy + dz * dz;
+                    if (squared < sphereRadius * sphereRadius) {
+                        auto depth = spheres[i].getRadius() - static_cast<Unit>(std::sqrt(squared));
+                        record(i, j, depth, Vec3U(std::llround(closest[0]), std::llround(closest[1]),
+                                                  std::llround(closest[2])));
+                    }
+                }
+            }
+        }
+
+        if (!info.collision) {
+            return;
+        }
+
+        info.contact = rotation.apply(closestPoint) + meshPos;
+        info.normal = (info.contact - spheres[bestSphere].getPosition()).normalize();
+        if (info.normal.isZero()) {
+            // the center lies on the triangle, push it back out of the front face
+            auto &triangle = triangles[info.rightSphere];
+            auto first = triangle.p1 - triangle.p0;
+            auto second = triangle.p2 - triangle.p0;
+            double face[3] = {double(first.y) * second.z - double(first.z) * second.y,
+                              double(first.z) * second.x - double(first.x) * second.z,
+                              double(first.x) * second.y - double(first.y) * second.x};
+            double length = std::sqrt(face[0] * face[0] + face[1] * face[1] + face[2] * face[2]);
+            if (length > 0) {
+                Vec3U scaled(std::llround(face[0] / length * RotationOne), std::llround(face[1] / length * RotationOne),
+                             std::llround(face[2] / length * RotationOne));
+                info.normal = -rotation.apply(scaled).normalize();
+            }
+        }
+    }
+
+    // Deepest penetration any sphere inside left can reach with any sphere inside right, plus one
+    // for the truncation of the sphere distances
+    static Unit maxDepth(const SphereU &left, const SphereU &right) {
+        return left.getRadius() + right.getRadius() - left.getPosition().distance(right.getPosition()) + 1;
+    }
+
+    static bool boundsOverlap(const SphereU &left, const SphereU &right) {
+        auto delta = right.getPosition() - left.getPosition();
+        double radius = static_cast<double>(left.getRadius()) + static_cast<double>(right.getRadius());
+        double distanceSquared = static_cast<double>(delta.x) * delta.x +
+                                 static_cast<double>(delta.y) * delta.y +
+                                 static_cast<double>(delta.z) * delta.z;
+        return distanceSquared < radius * radius;
+    }
 
 };
 
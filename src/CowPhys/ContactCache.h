@@ -0,0 +1,223 @@
+#ifndef COWPHYS_CONTACTCACHE_H
+#define COWPHYS_CONTACTCACHE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "CollisionChecker.h"
+
+namespace cp {
+
+struct ContactPair {
+    Body *left;
+    Body *right;
+    Unit depth;
+    Vec3U normal;
+    Vec3U contact;
+    int32_t leftSphere;
+    int32_t rightSphere;
+    bool isStatic; // right is a StaticBody
+    uint64_t tick; // last tick the pair touched
+    double impulse[3]; // total impulse the solver applied to right last tick, left got the opposite
+};
+
+// Ids of the two bodies of a pair, the lower one first
+struct ContactKey {
+    uint64_t low;
+    uint64_t high;
+
+    bool operator==(const ContactKey &rhs) const {
+        return low == rhs.low && high == rhs.high;
+    }
+
+    bool operator<(const ContactKey &rhs) const {
+        return low != rhs.low ? low < rhs.low : high < rhs.high;
+    }
+};
+
+struct ContactKeyHash {
+    size_t operator()(const ContactKey &key) const {
+        return std::hash<uint64_t>()(key.low * 0x9e3779b97f4a7c15ull ^ key.high);
+    }
+};
+
+// Every pair of bodies in contact, kept across ticks and keyed by the ids of the two bodies. The
+// bodies touching each body are listed by the slot of its handle, so a body is dropped without
+// going through every pair.
+class ContactCache {
+
+public:
+
+    static ContactKey key(const Body *left, const Body *right) {
+        auto a = left->getId();
+        auto b = right->getId();
+        return a < b ? ContactKey{a, b} : ContactKey{b, a};
+    }
+
+    const ContactPair *find(const Body *left, const Body *right) const {
+        auto it = mPairs.find(key(left, right));
+        return it == mPairs.end() ? nullptr : &it->second;
+    }
+
+    ContactPair *find(const Body *left, const Body *right) {
+        auto it = mPairs.find(key(left, right));
+        return it == mPairs.end() ? nullptr : &it->second;
+    }
+
+    // Hint for the narrowphase, oriented like the pair being tested
+    bool findHint(const Body *left, const Body *right, CollisionHint &hint) const {
+        auto pair = find(left, right);
+        if (pair == nullptr) {
+            return false;
+        }
+        if (pair->left == left) {
+            hint = {pair->leftSphere, pair->rightSphere};
+        } else {
+            hint = {pair->rightSphere, pair->leftSphere};
+        }
+        return true;
+    }
+
+    void beginTick() {
+        ++mTick;
+    }
+
+    // Records a contact found this tick, returns true when the pair was not touching last tick. A pair
+    // still touching keeps its impulse for the solver.
+    bool touch(Body *left, Body *right, bool isStatic, const CollisionInfo &info) {
+        auto result = mPairs.emplace(key(left, right), ContactPair());
+        auto &pair = result.first->second;
+        if (result.second) {
+            link(left, right);
+        } else if (pair.left != left) {
+            // the impulse follows the pair when its bodies come in the other order
+            for (auto &value: pair.impulse) {
+                value = -value;
+            }
+        }
+        pair.left = left;
+        pair.right = right;
+        pair.depth = info.depth;
+        pair.normal = info.normal;
+        pair.contact = info.contact;
+        pair.leftSphere = info.leftSphere;
+        pair.rightSphere = info.rightSphere;
+        pair.isStatic = isStatic;
+        pair.tick = mTick;
+        return result.second;
+    }
+
+    // Removes the pairs not touched this tick and appends them to ended, ordered by key. Pairs
+    // keepAlive returns true for were not tested, like two sleeping bodies resting on each other.
+    template<class F>
+    void endTick(F &&keepAlive, std::vector<std::pair<Body *, Body *>> &ended) {
+        mEnded.clear();
+        for (auto &entry: mPairs) {
+            if (entry.second.tick != mTick && !keepAlive(entry.second)) {
+                mEnded.push_back(entry.first);
+            }
+        }
+
+        eraseEnded(ended);
+    }
+
+    // Forgets every pair of a body, appending them to ended. Only the pairs of the body are visited.
+    void remove(const Body *body, std::vector<std::pair<Body *, Body *>> &ended) {
+        auto index = body->getHandle().index;
+        if (index >= mTouching.size()) {
+            return;
+        }
+
+        mEnded.clear();
+        for (auto other: mTouching[index]) {
+            mEnded.push_back(key(body, other));
+        }
+        eraseEnded(ended);
+    }
+
+    void clear() {
+        mPairs.clear();
+        mTouching.clear();
+    }
+
+    // Every pair ordered by key, so two equal caches always list them the same way
+    void getSortedPairs(std::vector<const ContactPair *> &pairs) const {
+        pairs.clear();
+        for (auto &entry: mPairs) {
+            pairs.push_back(&entry.second);
+        }
+        std::sort(pairs.begin(), pairs.end(), [](const ContactPair *left, const ContactPair *right) {
+            return key(left->left, left->right) < key(right->left, right->right);
+        });
+    }
+
+    // Restoring a snapshot, the cache is cleared, set to tick then refilled with insert
+    void reset(uint64_t tick) {
+        clear();
+        mTick = tick;
+    }
+
+    void insert(const ContactPair &pair) {
+        auto result = mPairs.emplace(key(pair.left, pair.right), pair);
+        if (result.second) {
+            link(pair.left, pair.right);
+        } else {
+            result.first->second = pair;
+        }
+    }
+
+    uint64_t getTick() const {
+        return mTick;
+    }
+
+    size_t size() const {
+        return mPairs.size();
+    }
+
+private:
+
+    std::vector<const Body *> &touchingOf(const Body *body) {
+        auto index = body->getHandle().index;
+        if (index >= mTouching.size()) {
+            mTouching.resize(index + 1);
+        }
+        return mTouching[index];
+    }
+
+    void link(const Body *left, const Body *right) {
+        touchingOf(left).push_back(right);
+        touchingOf(right).push_back(left);
+    }
+
+    void unlink(const Body *body, const Body *other) {
+        auto &touching = touchingOf(body);
+        auto it = std::find(touching.begin(), touching.end(), other);
+        *it = touching.back();
+        touching.pop_back();
+    }
+
+    // Erases the pairs listed in mEnded in key order, appending them to ended
+    void eraseEnded(std::vector<std::pair<Body *, Body *>> &ended) {
+        std::sort(mEnded.begin(), mEnded.end());
+        for (auto &pairKey: mEnded) {
+            auto it = mPairs.find(pairKey);
+            unlink(it->second.left, it->second.right);
+            unlink(it->second.right, it->second.left);
+            ended.emplace_back(it->second.left, it->second.right);
+            mPairs.erase(it);
+        }
+    }
+
+    std::unordered_map<ContactKey, ContactPair, ContactKeyHash> mPairs;
+    std::vector<ContactKey> mEnded;
+    // bodies in a pair with each body, by handle slot
+    std::vector<std::vector<const Body *>> mTouching;
+    uint64_t mTick = 0;
+
+};
+
+}
+
+#endif //COWPHYS_CONTACTCACHE_H
@@ -1,97 +1,726 @@
 #include "PhysWorld.h"
+#include <algorithm>
+#include <numeric>
 
 namespace cp {
 
-PhysWorld::PhysWorld() : mContactListener(nullptr), mMovementListener(nullptr) {
+PhysWorld::PhysWorld() : mContactListener(nullptr), mMovementListener(nullptr),
+                         mBroadPhaseType(BroadPhaseType::SweepAndPrune), mStaticBodiesDirty(false),
+                         mThreadPool(new ThreadPool(1)), mMovementEventsBuffered(false), mNextBodyId(0),
+                         mSleepTicks(30), mSolverIterations(8), mSphereTests(0), mRaycastNodeVisits(0) {
 
 }
 
 PhysWorld::~PhysWorld() {
+    for (auto body: mDynBodies) {
+        mDynBodyPool.destroy(body);
+    }
+    for (auto body: mStaticBodies) {
+        mStaticBodyPool.destroy(body);
+    }
+
     delete mContactListener;
     delete mMovementListener;
 }
 
+DynBody *PhysWorld::createDynBody(std::shared_ptr<const Shape> shape, Vec3U pos) {
+    shape->prepare();
+    auto newBody = mDynBodyPool.create(std::move(shape));
+    newBody->setPos(pos);
+    newBody->mId = mNextBodyId++;
+    newBody->mIndex = static_cast<uint32_t>(mDynBodies.size());
+    newBody->mHandle = allocateSlot(newBody, false);
+    mDynBodies.push_back(newBody);
+    return newBody;
+}
+
+StaticBody *PhysWorld::createStaticBody(std::shared_ptr<const Shape> shape, Vec3U pos) {
+    auto newBody = addStaticBody(std::move(shape), pos);
+    // made here rather than in the first step, a terrain can hold a lot of spheres
+    newBody->holdWorldSpheres();
+    wakeBodiesIn(newBody->getWorldAABB());
+    return newBody;
+}
+
+StaticBody *PhysWorld::createStaticCopy(StaticBody &original) {
+    auto newBody = addStaticBody(original.getSharedShape(), original.getPos());
+    newBody->setRotation(original.getRotation());
+    newBody->shareWorldSpheres(original);
+    wakeBodiesIn(newBody->getWorldAABB());
+    return newBody;
+}
+
+StaticBody *PhysWorld::addStaticBody(std::shared_ptr<const Shape> shape, Vec3U pos) {
+    shape->prepare();
+    auto newBody = mStaticBodyPool.create(std::move(shape));
+    newBody->setPos(pos);
+    newBody->mId = mNextBodyId++;
+    newBody->mIndex = static_cast<uint32_t>(mStaticBodies.size());
+    newBody->mHandle = allocateSlot(newBody, true);
+    mStaticBodies.push_back(newBody);
+    mStaticBodiesDirty = true;
+    return newBody;
+}
+
+bool PhysWorld::destroyBody(BodyHandle handle) {
+    auto body = getBody(handle);
+    if (body == nullptr) {
+        return false;
+    }
+
+    endContactsOf(body);
+
+    auto &slot = mBodySlots[handle.index];
+    auto index = body->mIndex;
+    auto shape = body->getShape();
+    if (slot.isStatic) {
+        // the sleeping bodies resting on it kept their contact with it, ending it woke them up
+        mStaticBodies[index] = mStaticBodies.back();
+        mStaticBodies[index]->mIndex = index;
+        mStaticBodies.pop_back();
+        mStaticBodyPool.destroy(static_cast<StaticBody *>(body));
+        mStaticBodiesDirty = true;
+    } else {
+        mDynamicTree.remove(static_cast<DynBody *>(body));
+        mDynBodies[index] = mDynBodies.back();
+        mDynBodies[index]->mIndex = index;
+        mDynBodies.pop_back();
+        mDynBodyPool.destroy(static_cast<DynBody *>(body));
+    }
+
+    slot.body = nullptr;
+    // zero is kept for handles that were never set
+    if (++slot.generation == 0) {
+        slot.generation = 1;
+    }
+    mFreeBodySlots.push_back(handle.index);
+
+    auto adopted = mAdoptedShapes.find(shape);
+    if (adopted != mAdoptedShapes.end() && adopted->second.expired()) {
+        mAdoptedShapes.erase(adopted);
+    }
+    return true;
+}
+
+BodyHandle PhysWorld::allocateSlot(Body *body, bool isStatic) {
+    BodyHandle handle;
+    if (mFreeBodySlots.empty()) {
+        handle.index = static_cast<uint32_t>(mBodySlots.size());
+        mBodySlots.push_back({nullptr, 1, false});
+    } else {
+        handle.index = mFreeBodySlots.back();
+        mFreeBodySlots.pop_back();
+    }
+
+    auto &slot = mBodySlots[handle.index];
+    slot.body = body;
+    slot.isStatic = isStatic;
+    handle.generation = slot.generation;
+    return handle;
+}
+
+std::shared_ptr<const Shape> PhysWorld::adoptShape(Shape *shape) {
+    auto &adopted = mAdoptedShapes[shape];
+    auto shared = adopted.lock();
+    if (shared == nullptr) {
+        shared = std::shared_ptr<const Shape>(shape);
+        adopted = shared;
+    }
+    return shared;
+}
+
+void PhysWorld::endContactsOf(Body *body) {
+    mEndedContacts.clear();
+    mContactCache.remove(body, mEndedContacts);
+    for (auto &pair: mEndedContacts) {
+        // a sleeping body resting on the destroyed one has to fall again
+        pair.first->wake();
+        pair.second->wake();
+        if (mContactListener != nullptr) {
+            mContactListener->onContactEnd(pair.first, pair.second);
+        }
+    }
+    mEndedContacts.clear();
+}
+
+void PhysWorld::setThreadCount(int threadCount) {
+    if (threadCount < 1) {
+        threadCount = 1;
+    }
+    if (threadCount != mThreadPool->getThreadCount()) {
+        mThreadPool.reset(new ThreadPool(threadCount));
+    }
+}
+
 void PhysWorld::update() {
+    // the stats of a step also take in the raycasts made until the next step
+    mStats = WorldStats();
+    mStats.tick = mContactCache.getTick() + 1;
+    mSphereTests.store(0, std::memory_order_relaxed);
+    mRaycastNodeVisits.store(0, std::memory_order_relaxed);
+    mProfiler.setTick(mStats.tick);
 
-    for (auto body: mDynBodies) {
-        auto oldPos = body->getPos();
-        auto oldRotation = body->getRotation();
-        body->update();
+    COWPHYS_PROFILE_SCOPE(mProfiler, "update", mStats.updateMs);
+    refreshStaticBodies();
+    integrate();
+    findPairs();
+    mStats.broadPhasePairs = getPairCount();
+    findContacts();
+    mStats.pairs = getPairCount();
+    updateContacts();
+    buildIslands();
+    solveIslands();
+    updateSleep();
+    collectMovementEvents();
+    dispatchContactEvents();
+
+    mStats.awakeBodies = mDynBodies.size() - getSleepingBodyCount();
+    mStats.contacts = mContactCache.size();
+    mStats.islands = mIslandStarts.empty() ? 0 : mIslandStarts.size() - 1;
+}
+
+void PhysWorld::integrate() {
+    COWPHYS_PROFILE_SCOPE(mProfiler, "integrate", mStats.integrateMs);
+    mPreviousTransforms.resize(mDynBodies.size());
+    mThreadPool->parallelFor(mDynBodies.size(), [this](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            auto body = mDynBodies[i];
+            mPreviousTransforms[i] = {body->getPos(), body->getRotation()};
+            if (body->isSleeping()) {
+                continue;
+            }
+            body->update();
+            body->updateWorldSpheres();
+        }
+    });
+
+    sweepContinuousBodies();
+
+    if (mMovementListener == nullptr || mMovementEventsBuffered) {
+        return;
+    }
 
-        if (mMovementListener != nullptr) {
-            if (body->getPos() != oldPos) {
-                mMovementListener->onMove(body, oldPos);
+    for (size_t i = 0; i < mDynBodies.size(); ++i) {
+        auto body = mDynBodies[i];
+        auto &previous = mPreviousTransforms[i];
+        if (body->getPos() != previous.pos) {
+            mMovementListener->onMove(body, previous.pos);
+        }
+        if (body->getRotation() != previous.rotation) {
+            mMovementListener->onRotate(body, previous.rotation);
+        }
+    }
+}
+
+void PhysWorld::sweepContinuousBodies() {
+    mContinuousBodies.clear();
+    for (size_t i = 0; i < mDynBodies.size(); ++i) {
+        auto body = mDynBodies[i];
+        if (body->hasContinuousCollision() && !body->isSleeping() && body->getPos() != mPreviousTransforms[i].pos) {
+            mContinuousBodies.push_back(static_cast<uint32_t>(i));
+        }
+    }
+    if (mContinuousBodies.empty() || mStaticBVH.empty()) {
+        return;
+    }
+
+    COWPHYS_PROFILE_SCOPE(mProfiler, "sweepContinuousBodies", mStats.continuousMs);
+    mStats.sweptBodies = mContinuousBodies.size();
+
+    // every body only moves itself back, the earliest hit does not depend on the order of the candidates
+    mThreadPool->parallelEach(mContinuousBodies.size(), [this](size_t i) {
+        COWPHYS_PROFILE_TALLY(sphereTests, mSphereTests);
+        auto index = mContinuousBodies[i];
+        auto body = mDynBodies[index];
+        auto start = mPreviousTransforms[index].pos;
+        auto motion = body->getPos() - start;
+
+        auto &aabb = body->getWorldAABB();
+        auto min = aabb.getMin().min(aabb.getMin() - motion);
+        auto max = aabb.getMax().max(aabb.getMax() - motion);
+        double time = 1;
+        mStaticBVH.query(min, max, [body, &motion, &time](StaticBody *other) {
+            if (body->canCollideWith(*other)) {
+                CollisionChecker::sweepCollision(body, motion, other, time);
+            }
+        });
+        if (time >= 1) {
+            return;
+        }
+
+        // stop a little past the first contact so the narrowphase sees it and responds this step
+        auto length = static_cast<double>(motion.length());
+        time = std::min(1.0, time + ContinuousSkin / length);
+        body->movePos(start + Vec3U(static_cast<Unit>(std::llround(motion.x * time)),
+                                    static_cast<Unit>(std::llround(motion.y * time)),
+                                    static_cast<Unit>(std::llround(motion.z * time))));
+        body->updateWorldSpheres();
+    });
+}
+
+void PhysWorld::findPairs() {
+    COWPHYS_PROFILE_SCOPE(mProfiler, "findPairs", mStats.broadPhaseMs);
+    mDynPairs.clear();
+    mStaticPairs.clear();
+
+    if (mBroadPhaseType != BroadPhaseType::BruteForce) {
+        if (mBroadPhaseType == BroadPhaseType::DynamicTree) {
+            mDynamicTree.findPairs(mDynBodies, mDynPairs);
+        } else {
+            mSweepAndPrune.findPairs(mDynBodies, mDynPairs);
+        }
+
+        // each body queries the static tree on its own, the lists are joined in body order
+        mStaticCandidates.resize(mDynBodies.size());
+        mThreadPool->parallelFor(mDynBodies.size(), [this](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                auto &candidates = mStaticCandidates[i];
+                candidates.clear();
+                if (mDynBodies[i]->isSleeping()) {
+                    continue;
+                }
+                auto body = mDynBodies[i];
+                auto &aabb = body->getWorldAABB();
+                mStaticBVH.query(aabb.getMin(), aabb.getMax(), [body, &candidates](StaticBody *other) {
+                    if (body->canCollideWith(*other)) {
+                        candidates.push_back(other);
+                    }
+                });
+            }
+        });
+
+        for (size_t i = 0; i < mDynBodies.size(); ++i) {
+            if (mDynBodies[i]->isSleeping()) {
+                continue;
             }
-            if (body->getRotation() != oldRotation) {
-                mMovementListener->onRotate(body, oldRotation);
+            for (auto other: mStaticCandidates[i]) {
+                mStaticPairs.emplace_back(mDynBodies[i], other);
             }
         }
+        return;
     }
 
     for (auto body: mDynBodies) {
+        for (auto other: mDynBodies) {
+            // this check is there to only check that collision once
+            if (body->getId() < other->getId() && body->canCollideWith(*other)) {
+                mDynPairs.emplace_back(body, other);
+            }
+        }
+
+        if (body->isSleeping()) {
+            continue;
+        }
+
+        for (auto other: mStaticBodies) {
+            if (body->canCollideWith(*other)) {
+                mStaticPairs.emplace_back(body, other);
+            }
+        }
+    }
+    // bodies are listed by index, which stops following the ids once one is destroyed
+    std::sort(mDynPairs.begin(), mDynPairs.end(), pairIdLess);
+}
+
+void PhysWorld::findContacts() {
+    COWPHYS_PROFILE_SCOPE(mProfiler, "findContacts", mStats.narrowPhaseMs);
+    // two sleeping bodies are resting where they last touched, there is nothing new to find
+    mDynPairs.erase(std::remove_if(mDynPairs.begin(), mDynPairs.end(), [](const DynPair &pair) {
+        return pair.first->isSleeping() && pair.second->isSleeping();
+    }), mDynPairs.end());
+    holdPairedSpheres();
+
+    mDynContacts.resize(mDynPairs.size());
+    mThreadPool->parallelEach(mDynPairs.size(), [this](size_t i) {
+        COWPHYS_PROFILE_TALLY(sphereTests, mSphereTests);
+        auto &pair = mDynPairs[i];
+        CollisionHint hint;
+        bool hasHint = mContactCache.findHint(pair.first, pair.second, hint);
+        mDynContacts[i] = CollisionChecker::checkCollision(pair.first, pair.second, hasHint ? &hint : nullptr);
+    });
+
+    mStaticContacts.resize(mStaticPairs.size());
+    mThreadPool->parallelEach(mStaticPairs.size(), [this](size_t i) {
+        COWPHYS_PROFILE_TALLY(sphereTests, mSphereTests);
+        auto &pair = mStaticPairs[i];
+        CollisionHint hint;
+        bool hasHint = mContactCache.findHint(pair.first, pair.second, hint);
+        mStaticContacts[i] = CollisionChecker::checkCollision(pair.first, pair.second, hasHint ? &hint : nullptr);
+    });
+}
+
+void PhysWorld::holdPairedSpheres() {
+    mPairedBodies.assign(mDynBodies.size(), 0);
+    for (auto &pair: mDynPairs) {
+        mPairedBodies[pair.first->getIndex()] = 1;
+        mPairedBodies[pair.second->getIndex()] = 1;
+    }
+    for (auto &pair: mStaticPairs) {
+        mPairedBodies[pair.first->getIndex()] = 1;
+    }
+
+    // the narrowphase only reads them, every body is held or released by a single thread beforehand
+    mThreadPool->parallelFor(mDynBodies.size(), [this](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            if (mPairedBodies[i] != 0) {
+                mDynBodies[i]->holdWorldSpheres();
+            } else {
+                mDynBodies[i]->releaseWorldSpheres();
+            }
+        }
+    });
+}
+
+void PhysWorld::updateContacts() {
+    COWPHYS_PROFILE_SCOPE(mProfiler, "updateContacts", mStats.contactsMs);
+    mContactCache.beginTick();
+    mBegunContacts.clear();
+    mEndedContacts.clear();
+
+    for (size_t i = 0; i < mDynPairs.size(); ++i) {
+        mStats.collisions += mDynContacts[i].collision ? 1 : 0;
+        if (mDynContacts[i].collision &&
+            mContactCache.touch(mDynPairs[i].first, mDynPairs[i].second, false, mDynContacts[i])) {
+            mBegunContacts.emplace_back(mDynPairs[i].first, mDynPairs[i].second);
+        }
+    }
 
-        for (auto other: mDynBodies) { ;
-            if (body != other && body < other) { // this check is there to only check that collision once
-                auto collision = CollisionChecker::checkCollision(body, other);
-                if (collision.collision) {
-                    resolveCollision(body, other, collision);
+    for (size_t i = 0; i < mStaticPairs.size(); ++i) {
+        mStats.collisions += mStaticContacts[i].collision ? 1 : 0;
+        if (mStaticContacts[i].collision &&
+            mContactCache.touch(mStaticPairs[i].first, mStaticPairs[i].second, true, mStaticContacts[i])) {
+            mBegunContacts.emplace_back(mStaticPairs[i].first, mStaticPairs[i].second);
+        }
+    }
+
+    // pairs where every moving body sleeps were not tested, they are still touching
+    mContactCache.endTick([](const ContactPair &pair) {
+        return pair.left->isSleeping() && (pair.isStatic || pair.right->isSleeping());
+    }, mEndedContacts);
+}
+
+void PhysWorld::dispatchContactEvents() {
+    if (mContactListener == nullptr) {
+        return;
+    }
+
+    COWPHYS_PROFILE_SCOPE(mProfiler, "dispatchContactEvents", mStats.eventsMs);
+
+    for (auto &pair: mBegunContacts) {
+        mContactListener->onContactBegin(pair.first, pair.second);
+    }
+    for (auto &pair: mEndedContacts) {
+        mContactListener->onContactEnd(pair.first, pair.second);
+    }
+}
+
+void PhysWorld::collectMovementEvents() {
+    if (!mMovementEventsBuffered) {
+        return;
+    }
+
+    COWPHYS_PROFILE_SCOPE(mProfiler, "collectMovementEvents", mStats.eventsMs);
+
+    mMovementEvents.clear();
+    for (size_t i = 0; i < mDynBodies.size(); ++i) {
+        auto body = mDynBodies[i];
+        auto &previous = mPreviousTransforms[i];
+        if (body->getPos() != previous.pos || body->getRotation() != previous.rotation) {
+            mMovementEvents.push_back({body, previous.pos, body->getPos(), previous.rotation, body->getRotation()});
+        }
+    }
+
+    if (mMovementListener != nullptr && !mMovementEvents.empty()) {
+        mMovementListener->onMovements(mMovementEvents.data(), mMovementEvents.size());
+    }
+}
+
+uint32_t PhysWorld::findIsland(uint32_t body) {
+    while (mIslandParents[body] != body) {
+        mIslandParents[body] = mIslandParents[mIslandParents[body]];
+        body = mIslandParents[body];
+    }
+    return body;
+}
+
+void PhysWorld::buildIslands() {
+    COWPHYS_PROFILE_SCOPE(mProfiler, "buildIslands", mStats.islandsMs);
+    // bodies touching each other end up in the same island, whose root is its lowest body index
+    mIslandParents.resize(mDynBodies.size());
+    std::iota(mIslandParents.begin(), mIslandParents.end(), 0);
+    // every body is woken before any is joined, a pair passed over while one of its bodies still slept
+    // would otherwise leave two islands sharing a body that a later pair woke up
+    for (size_t i = 0; i < mDynPairs.size(); ++i) {
+        if (mDynContacts[i].collision) {
+            // a sleeping body is only woken by a body that was not already resting on it, otherwise
+            // the two would keep waking each other up
+            auto first = mDynPairs[i].first;
+            auto second = mDynPairs[i].second;
+            if (first->isSleeping() && second->mRestTicks == 0) {
+                first->wake();
+            } else if (second->isSleeping() && first->mRestTicks == 0) {
+                second->wake();
+            }
+        }
+    }
+    for (size_t i = 0; i < mDynPairs.size(); ++i) {
+        if (mDynContacts[i].collision) {
+            // a body still asleep is pushed against like a static one, it joins no island
+            if (mDynPairs[i].first->isSleeping() || mDynPairs[i].second->isSleeping()) {
+                continue;
+            }
+
+            auto left = findIsland(mDynPairs[i].first->getIndex());
+            auto right = findIsland(mDynPairs[i].second->getIndex());
+            if (left < right) {
+                mIslandParents[right] = left;
+            } else if (right < left) {
+                mIslandParents[left] = right;
+            }
+        }
+    }
+
+    mIslandIndices.assign(mDynBodies.size(), std::numeric_limits<uint32_t>::max());
+    uint32_t islandCount = 0;
+    mContactRefs.clear();
+    auto addContact = [this, &islandCount](uint32_t body, uint32_t pair, bool isStatic) {
+        auto root = findIsland(body);
+        if (mIslandIndices[root] == std::numeric_limits<uint32_t>::max()) {
+            mIslandIndices[root] = islandCount++;
+        }
+        mContactRefs.push_back({mIslandIndices[root], pair, isStatic});
+    };
+
+    for (size_t i = 0; i < mDynPairs.size(); ++i) {
+        if (mDynContacts[i].collision) {
+            auto awake = mDynPairs[i].first->isSleeping() ? mDynPairs[i].second : mDynPairs[i].first;
+            addContact(awake->getIndex(), static_cast<uint32_t>(i), false);
+        }
+    }
+    for (size_t i = 0; i < mStaticPairs.size(); ++i) {
+        if (mStaticContacts[i].collision) {
+            addContact(mStaticPairs[i].first->getIndex(), static_cast<uint32_t>(i), true);
+        }
+    }
+
+    // counting sort keeps the pair order inside every island
+    mIslandStarts.assign(islandCount + 1, 0);
+    for (auto &ref: mContactRefs) {
+        ++mIslandStarts[ref.island + 1];
+    }
+    for (uint32_t i = 0; i < islandCount; ++i) {
+        mIslandStarts[i + 1] += mIslandStarts[i];
+    }
+    mSortedContactRefs.resize(mContactRefs.size());
+    mIslandCursors.assign(mIslandStarts.begin(), mIslandStarts.end() - 1);
+    for (auto &ref: mContactRefs) {
+        mSortedContactRefs[mIslandCursors[ref.island]++] = ref;
+    }
+}
+
+void PhysWorld::solveIslands() {
+    if (mIslandStarts.size() < 2) {
+        return;
+    }
+
+    COWPHYS_PROFILE_SCOPE(mProfiler, "solveIslands", mStats.solveMs);
+
+    // islands share no DynBody, so they can be resolved at the same time in any order
+    if (mSolverIterations > 0) {
+        mSolverContacts.resize(mSortedContactRefs.size());
+        mSolverVelocities.resize(mDynBodies.size());
+        mThreadPool->parallelEach(mIslandStarts.size() - 1, [this](size_t island) {
+            solveIsland(island);
+        });
+        return;
+    }
+
+    mThreadPool->parallelEach(mIslandStarts.size() - 1, [this](size_t island) {
+        for (auto i = mIslandStarts[island]; i < mIslandStarts[island + 1]; ++i) {
+            auto &ref = mSortedContactRefs[i];
+            if (ref.isStatic) {
+                resolveCollision(mStaticPairs[ref.pair].first, mStaticContacts[ref.pair]);
+            } else {
+                // a body still asleep is pushed against like a static one and left untouched
+                auto &pair = mDynPairs[ref.pair];
+                auto &collision = mDynContacts[ref.pair];
+                if (pair.first->isSleeping()) {
+                    CollisionInfo flipped = collision;
+                    flipped.normal = -collision.normal;
+                    resolveCollision(pair.second, flipped);
+                } else if (pair.second->isSleeping()) {
+                    resolveCollision(pair.first, collision);
+                } else {
+                    resolveCollision(pair.first, pair.second, collision);
                 }
             }
         }
+    });
+}
 
-        for (auto other: mStaticBodies) {
-            auto collision = CollisionChecker::checkCollision(body, other);
-            if (collision.collision) {
-                resolveCollision(body, other, collision);
+void PhysWorld::updateSleep() {
+    if (mSleepTicks == 0) {
+        return;
+    }
+
+    COWPHYS_PROFILE_SCOPE(mProfiler, "updateSleep", mStats.sleepMs);
+
+    mThreadPool->parallelFor(mDynBodies.size(), [this](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            auto body = mDynBodies[i];
+            if (body->isSleeping()) {
+                continue;
+            }
+
+            if (body->isResting()) {
+                if (++body->mRestTicks >= mSleepTicks) {
+                    body->mSleeping = true;
+                }
+            } else {
+                body->mRestTicks = 0;
             }
         }
+    });
+}
+
+void PhysWorld::wakeBodiesIn(const AABB<Unit> &aabb) {
+    for (auto body: mDynBodies) {
+        if (body->isSleeping() && body->getWorldAABB().collides(aabb)) {
+            body->wake();
+        }
     }
 }
 
-WorldRaycast PhysWorld::raycast(Vec3U pos, Vec3U dir, Body *bodyToIgnore) {
-    WorldRaycast raycast;
+void PhysWorld::refreshStaticBodies() {
+    if (mStaticBodiesDirty) {
+        COWPHYS_PROFILE_SCOPE(mProfiler, "refreshStaticBodies", mStats.staticRefreshMs);
+        // static bodies keep their world spheres for good, one turned since its creation is brought
+        // up to date here, before several threads read it
+        mThreadPool->parallelFor(mStaticBodies.size(), [this](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                mStaticBodies[i]->holdWorldSpheres();
+            }
+        });
+        mStaticBVH.build(mStaticBodies);
+        mStaticBodiesDirty = false;
+    }
+}
+
+void PhysWorld::initRaycast(WorldRaycast &raycast) {
     raycast.body = nullptr;
     raycast.shape = nullptr;
+    raycast.sphere = -1;
     raycast.distance = std::numeric_limits<Unit>::max();
+    raycast.contact = Vec3U();
+}
+
+void PhysWorld::finishRaycast(WorldRaycast &raycast, const Vec3U &pos, const Vec3U &dir) {
+    if (raycast.body != nullptr) {
+        raycast.shape = raycast.body->getShape();
+        raycast.contact = pos + dir * raycast.distance;
+    }
+}
+
+WorldRaycast PhysWorld::raycast(Vec3U pos, Vec3U dir, Body *bodyToIgnore, uint32_t mask) {
+    refreshStaticBodies();
+
+    COWPHYS_PROFILE_SCOPE(mProfiler, "raycast", mStats.raycastMs);
+    COWPHYS_PROFILE_TALLY(nodeVisits, mRaycastNodeVisits);
+    ++mStats.raycasts;
+
+    WorldRaycast raycast;
+    initRaycast(raycast);
 
     for (auto body: mDynBodies) {
-        if (body != bodyToIgnore) {
-            if (body->raycast(pos, dir, raycast.distance)) {
+        if (body != bodyToIgnore && (body->getCategory() & mask) != 0) {
+            if (body->raycast(pos, dir, raycast.distance, &raycast.sphere)) {
                 raycast.body = body;
             }
         }
     }
 
-    for (auto body: mStaticBodies) {
-        if (body != bodyToIgnore) {
-            if (body->raycast(pos, dir, raycast.distance)) {
+    mStaticBVH.raycast(pos, dir, raycast.distance, [&raycast, bodyToIgnore, mask, &pos, &dir](StaticBody *body,
+                                                                                               Unit &t) {
+        if (body != bodyToIgnore && (body->getCategory() & mask) != 0) {
+            if (body->raycast(pos, dir, t, &raycast.sphere)) {
                 raycast.body = body;
             }
         }
-    }
+    });
 
+    finishRaycast(raycast, pos, dir);
     return raycast;
 }
 
+void PhysWorld::raycastBatch(const RaycastQuery *queries, WorldRaycast *results, size_t count,
+                             const RaycastFilter &filter) {
+    refreshStaticBodies();
+
+    COWPHYS_PROFILE_SCOPE(mProfiler, "raycastBatch", mStats.raycastMs);
+    COWPHYS_PROFILE_TALLY(nodeVisits, mRaycastNodeVisits);
+    mStats.raycasts += count;
+
+    mRayPacket.clear();
+    for (size_t i = 0; i < count; ++i) {
+        initRaycast(results[i]);
+        mRayPacket.add(queries[i].pos, queries[i].dir);
+    }
+
+    auto test = [this, queries, results, &filter](Body *body, uint32_t ray) {
+        auto &query = queries[ray];
+        auto &result = results[ray];
+        if (mRayPacket.getMaxT(ray) < 0 || body == query.bodyToIgnore || (body->getCategory() & filter.mask) == 0 ||
+            (filter.ignoreGroup != 0 && body->getIgnoreGroup() == filter.ignoreGroup)) {
+            return;
+        }
+        for (auto ignored: filter.bodiesToIgnore) {
+            if (ignored == body) {
+                return;
+            }
+        }
+        if (filter.accept && !filter.accept(body)) {
+            return;
+        }
+
+        if (body->raycast(query.pos, query.dir, result.distance, &result.sphere, filter.anyHit)) {
+            result.body = body;
+            // a retired ray is skipped by the rest of the traversal
+            mRayPacket.setMaxT(ray, filter.anyHit ? -1 : static_cast<double>(result.distance));
+        }
+    };
+
+    // static geometry first, its hits shorten the rays before the dynamic bodies are tested
+    mStaticBVH.raycastPacket(mRayPacket, mPacketRays, test);
+
+    // dynamic bodies move every tick, a throwaway tree over them is still far cheaper than
+    // testing every ray against every body once the batch is large
+    mRaycastBVH.build(mDynBodies);
+    mRaycastBVH.raycastPacket(mRayPacket, mPacketRays, test);
+
+    for (size_t i = 0; i < count; ++i) {
+        finishRaycast(results[i], queries[i].pos, queries[i].dir);
+    }
+}
+
 void PhysWorld::resolveCollision(DynBody *bodyA, DynBody *bodyB, CollisionInfo &collision) {
 
     auto impulse = collision.normal;
 
-    bodyA->applyForceAt(-impulse, collision.contact);
-    bodyB->applyForceAt(impulse, collision.contact);
+    bodyA->accelerateAt(-impulse, collision.contact);
+    bodyB->accelerateAt(impulse, collision.contact);
 
     Vec3U mtv = collision.normal * collision.depth;
-    bodyA->setPos(bodyA->getPos() - (mtv / 2));
-    bodyB->setPos(bodyB->getPos() + (mtv / 2));
+    bodyA->movePos(bodyA->getPos() - (mtv / 2));
+    bodyB->movePos(bodyB->getPos() + (mtv / 2));
 }
 
-void PhysWorld::resolveCollision(DynBody *bodyA, StaticBody *bodyB, CollisionInfo &collision) {
+void PhysWorld::resolveCollision(DynBody *bodyA, CollisionInfo &collision) {
     auto impulse = collision.normal * -bodyA->getVelocity();
 
-    bodyA->applyForceAt(-impulse, collision.contact);
+    bodyA->accelerateAt(-impulse, collision.contact);
 
     Vec3U mtv = collision.normal * collision.depth;
-    bodyA->setPos(bodyA->getPos() - mtv);
+    bodyA->movePos(bodyA->getPos() - mtv);
 }
 
 }
\ No newline at end of file
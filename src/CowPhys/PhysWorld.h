@@ -1,57 +1,179 @@
 #ifndef COWPHYS_PHYSWORLD_H
 #define COWPHYS_PHYSWORLD_H
 
+#include <functional>
+#include <memory>
+#include <unordered_map>
 #include <vector>
 #include "CollisionChecker.h"
+#include "ContactCache.h"
 #include "body/Body.h"
 #include "CowPhys/body/DynBody.h"
 #include "CowPhys/body/StaticBody.h"
+#include "CowPhys/body/BodyPool.h"
 #include "interface/ContactListener.h"
 #include "interface/MovementListener.h"
+#include "broadphase/BroadPhase.h"
+#include "broadphase/SweepAndPrune.h"
+#include "broadphase/DynamicTree.h"
+#include "broadphase/BodyBVH.h"
+#include "broadphase/RayPacket.h"
+#include "thread/ThreadPool.h"
+#include "profile/Profiler.h"
 
 namespace cp {
 
 struct WorldRaycast {
     Unit distance;
     Vec3U contact;
-    Shape *shape;
+    const Shape *shape;
     Body *body;
+    int32_t sphere; // index of the sphere hit in the shape, -1 without hit
+};
+
+struct RaycastQuery {
+    Vec3U pos;
+    Vec3U dir;
+    Body *bodyToIgnore = nullptr;
+};
+
+struct RaycastFilter {
+    // bodies ignored by every ray of the batch
+    std::vector<const Body *> bodiesToIgnore;
+    // only bodies in one of these categories can be hit, checked before any sphere
+    uint32_t mask = Body::AllCategories;
+    // bodies of this ignore group are skipped, 0 skips none
+    uint32_t ignoreGroup = 0;
+    // when set, only bodies it returns true for can be hit
+    std::function<bool(Body *)> accept;
+    // stop every ray at its first hit instead of the closest one, for occlusion checks
+    bool anyHit = false;
+};
+
+// What the last step spent its time on. The timings and the sphere and node counts stay at zero when
+// COWPHYS_PROFILING is 0.
+struct WorldStats {
+    uint64_t tick = 0;
+
+    // milliseconds
+    double updateMs = 0;
+    double staticRefreshMs = 0;
+    double integrateMs = 0;
+    double continuousMs = 0; // part of integrateMs
+    double broadPhaseMs = 0;
+    double narrowPhaseMs = 0;
+    double contactsMs = 0;
+    double islandsMs = 0;
+    double solveMs = 0;
+    double sleepMs = 0;
+    double eventsMs = 0;
+
+    size_t awakeBodies = 0;
+    size_t sweptBodies = 0; // continuous bodies swept against the static bodies
+    size_t broadPhasePairs = 0; // pairs found by the broadphase
+    size_t pairs = 0; // pairs tested by the narrowphase, pairs of two sleeping bodies are skipped
+    uint64_t sphereTests = 0; // sphere against sphere or triangle tests of the narrowphase
+    size_t collisions = 0; // tested pairs found touching
+    size_t contacts = 0; // touching pairs, sleeping ones included
+    size_t islands = 0;
+
+    // every raycast since the last step began, batched rays included
+    size_t raycasts = 0;
+    double raycastMs = 0;
+    uint64_t raycastNodeVisits = 0; // broadphase and shape tree nodes the rays went through
 };
 
 class PhysWorld {
 
 public:
 
+    // How far past the first contact a swept body is stopped, in units along its motion
+    static constexpr double ContinuousSkin = 2;
+
     PhysWorld();
 
     ~PhysWorld();
 
     void update();
 
-    WorldRaycast raycast(Vec3U pos, Vec3U dir, Body *bodyToIgnore = nullptr);
+    // Only bodies with a category in mask can be hit
+    WorldRaycast raycast(Vec3U pos, Vec3U dir, Body *bodyToIgnore = nullptr, uint32_t mask = Body::AllCategories);
+
+    // Casts count rays at once, walking the static tree a single time for the whole batch
+    void raycastBatch(const RaycastQuery *queries, WorldRaycast *results, size_t count,
+                      const RaycastFilter &filter = RaycastFilter());
+
+    void raycastBatch(const std::vector<RaycastQuery> &queries, std::vector<WorldRaycast> &results,
+                      const RaycastFilter &filter = RaycastFilter()) {
+        results.resize(queries.size());
+        raycastBatch(queries.data(), results.data(), queries.size(), filter);
+    }
 
+    // Applies the force to every awake DynBody, sleeping bodies are left asleep
     void applyForceToAllDynBodies(Vec3U force) {
         for (auto &body: mDynBodies) {
-            body->applyForce(force);
+            if (!body->isSleeping()) {
+                body->accelerate(force);
+            }
         }
     }
 
+    // The world takes ownership of the shape, it is deleted along with the last body using it
     DynBody *createDynBody(Shape *shape, Vec3U pos) {
-        auto newBody = new DynBody(shape);
-        newBody->setPos(pos);
-        mDynBodies.push_back(newBody);
-        return newBody;
+        return createDynBody(adoptShape(shape), pos);
     }
 
+    // Shares the shape, typically one interned by a ShapeRegistry
+    DynBody *createDynBody(std::shared_ptr<const Shape> shape, Vec3U pos);
+
     std::vector<DynBody *> &getDynBodies() {
         return mDynBodies;
     }
 
     StaticBody *createStaticBody(Shape *shape, Vec3U pos) {
-        auto newBody = new StaticBody(shape);
-        newBody->setPos(pos);
-        mStaticBodies.push_back(newBody);
-        return newBody;
+        return createStaticBody(adoptShape(shape), pos);
+    }
+
+    StaticBody *createStaticBody(std::shared_ptr<const Shape> shape, Vec3U pos);
+
+    // Adds a static body where a static body of another world is, with the same shape and rotation. The copy
+    // shares the world spheres of the original rather than making its own, which for a terrain is most of
+    // what the body costs.
+    StaticBody *createStaticCopy(StaticBody &original);
+
+    // Returns nullptr when the handle is stale, its body was destroyed since
+    Body *getBody(BodyHandle handle) const {
+        if (handle.index >= mBodySlots.size() || mBodySlots[handle.index].generation != handle.generation) {
+            return nullptr;
+        }
+        return mBodySlots[handle.index].body;
+    }
+
+    DynBody *getDynBody(BodyHandle handle) const {
+        auto body = getBody(handle);
+        return body != nullptr && !mBodySlots[handle.index].isStatic ? static_cast<DynBody *>(body) : nullptr;
+    }
+
+    StaticBody *getStaticBody(BodyHandle handle) const {
+        auto body = getBody(handle);
+        return body != nullptr && mBodySlots[handle.index].isStatic ? static_cast<StaticBody *>(body) : nullptr;
+    }
+
+    // Removes the body in constant time, the last body of its list takes its index. Its contacts
+    // end right away. Returns false for a stale handle. Must not be called during update.
+    bool destroyBody(BodyHandle handle);
+
+    bool destroyBody(Body *body) {
+        return body != nullptr && destroyBody(body->getHandle());
+    }
+
+    // Must be called after moving, rotating or reshaping a static body so the static tree gets rebuilt,
+    // every sleeping body is woken up since the ground under it may have changed.
+    void invalidateStaticBodies() {
+        mStaticBodiesDirty = true;
+        for (auto body: mDynBodies) {
+            body->wake();
+        }
     }
 
     std::vector<StaticBody *> &getStaticBodies() {
@@ -66,16 +188,267 @@ public:
         mMovementListener = movementListener;
     }
 
+    // Buffered movement events are collected once the step is over, so they include collision
+    // responses, and handed to the listener in one onMovements call. They can also be polled.
+    void setMovementEventsBuffered(bool buffered) {
+        mMovementEventsBuffered = buffered;
+        mMovementEvents.clear();
+    }
+
+    bool areMovementEventsBuffered() const {
+        return mMovementEventsBuffered;
+    }
+
+    // Bodies moved or rotated by the last step, empty unless movement events are buffered
+    const std::vector<MovementEvent> &getMovementEvents() const {
+        return mMovementEvents;
+    }
+
+    void setBroadPhaseType(BroadPhaseType type) {
+        mBroadPhaseType = type;
+    }
+
+    BroadPhaseType getBroadPhaseType() const {
+        return mBroadPhaseType;
+    }
+
+    // Number of threads stepping the world, the calling thread included. The result of a step
+    // never depends on it.
+    void setThreadCount(int threadCount);
+
+    int getThreadCount() const {
+        return mThreadPool->getThreadCount();
+    }
+
+    // Number of ticks a DynBody has to stay without linear and angular velocity before it falls
+    // asleep, zero keeps every body awake
+    void setSleepTicks(uint32_t ticks) {
+        mSleepTicks = ticks;
+        if (ticks == 0) {
+            for (auto body: mDynBodies) {
+                body->wake();
+            }
+        }
+    }
+
+    uint32_t getSleepTicks() const {
+        return mSleepTicks;
+    }
+
+    // Passes of the contact solver over every contact of an island per step, more make stacks settle
+    // faster. The solver reads restitution and friction as hundredths. 0 falls back to pushing every
+    // contact apart on its own, the resolution used before the solver existed.
+    void setSolverIterations(uint32_t iterations) {
+        mSolverIterations = iterations;
+    }
+
+    uint32_t getSolverIterations() const {
+        return mSolverIterations;
+    }
+
+    // Contact between two bodies as of the last step, nullptr when they are not touching
+    const ContactPair *getContact(const Body *left, const Body *right) const {
+        return mContactCache.find(left, right);
+    }
+
+    size_t getContactCount() const {
+        return mContactCache.size();
+    }
+
+    // Body pairs the broadphase handed to the narrowphase during the last step
+    size_t getPairCount() const {
+        return mDynPairs.size() + mStaticPairs.size();
+    }
+
+    WorldStats getStats() const {
+        auto stats = mStats;
+        stats.sphereTests = mSphereTests.load(std::memory_order_relaxed);
+        stats.raycastNodeVisits = mRaycastNodeVisits.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    // Keeps the last capacity timed scopes of steps and raycasts for writeTrace, 0 turns tracing off
+    void setTraceCapacity(size_t capacity) {
+        mProfiler.setTraceCapacity(capacity);
+    }
+
+    // Writes the kept scopes as Chrome trace JSON, to attribute a slow step to one of its phases
+    void writeTrace(std::ostream &out) const {
+        mProfiler.writeTrace(out);
+    }
+
+    // Writes the state the simulation evolves into buffer, which is overwritten: position, rotation,
+    // velocities and sleep state of every DynBody, the transform of every static body and the contact
+    // cache. Shapes and body settings are not part of it. Stepping a world restored from the blob gives
+    // the same results as stepping the world it was taken from.
+    void saveState(std::vector<uint8_t> &buffer) const;
+
+    // Restores a blob written by saveState. The world must hold the same bodies, under the same
+    // handles, as when it was saved, otherwise false is returned and the world is left untouched.
+    bool loadState(const uint8_t *data, size_t size);
+
+    bool loadState(const std::vector<uint8_t> &buffer) {
+        return loadState(buffer.data(), buffer.size());
+    }
+
+    size_t getSleepingBodyCount() const {
+        size_t count = 0;
+        for (auto body: mDynBodies) {
+            if (body->isSleeping()) {
+                ++count;
+            }
+        }
+        return count;
+    }
+
 private:
+
+    struct PreviousTransform {
+        Vec3U pos;
+        Vec3Small rotation;
+    };
+
+    struct BodySlot {
+        Body *body;
+        uint32_t generation;
+        bool isStatic;
+    };
+
+    struct ContactRef {
+        uint32_t island;
+        uint32_t pair;
+        bool isStatic;
+    };
+
+    // A contact as the solver sees it, a body that does not move has no DynBody and no inverse mass
+    struct SolverContact {
+        DynBody *left;
+        DynBody *right;
+        ContactPair *cached;
+        double normal[3];
+        double tangents[2][3];
+        double leftInverseMass;
+        double rightInverseMass;
+        double effectiveMass;
+        double friction;
+        double bounce;
+        Unit depth;
+        double normalImpulse;
+        double tangentImpulses[2];
+    };
+
+    struct SolverVelocity {
+        double value[3];
+        // highest friction among the contacts of the body, it damps the spin once per step
+        double friction;
+        bool written;
+    };
+
+    BodyHandle allocateSlot(Body *body, bool isStatic);
+
+    std::shared_ptr<const Shape> adoptShape(Shape *shape);
+
+    void endContactsOf(Body *body);
+
+    void integrate();
+
+    // Moves the continuous bodies that went through a static body this step back to where they hit it
+    void sweepContinuousBodies();
+
+    void findPairs();
+
+    void findContacts();
+
+    // Holds the world spheres of the dynamic bodies in a pair and releases those of the others
+    void holdPairedSpheres();
+
+    void updateContacts();
+
+    void dispatchContactEvents();
+
+    void collectMovementEvents();
+
+    void buildIslands();
+
+    void solveIslands();
+
+    // Sequential impulses over the contacts of one island, warm started from the impulses of the last step
+    void solveIsland(size_t island);
+
+    void setupSolverContact(const ContactRef &ref, SolverContact &contact);
+
+    void updateSleep();
+
+    void wakeBodiesIn(const AABB<Unit> &aabb);
+
+    uint32_t findIsland(uint32_t body);
+
+    void refreshStaticBodies();
+
+    // Adds the static body to the lists, it still has to wake the bodies around it
+    StaticBody *addStaticBody(std::shared_ptr<const Shape> shape, Vec3U pos);
+
+    static void initRaycast(WorldRaycast &raycast);
+
+    static void finishRaycast(WorldRaycast &raycast, const Vec3U &pos, const Vec3U &dir);
+
     void resolveCollision(DynBody *bodyA, DynBody *bodyB, CollisionInfo &collision);
 
-    void resolveCollision(DynBody *bodyA, StaticBody *bodyB, CollisionInfo &collision);
+    // Resolves a contact against a body that does not move, a static or sleeping one
+    void resolveCollision(DynBody *bodyA, CollisionInfo &collision);
 
     ContactListener *mContactListener;
     MovementListener *mMovementListener;
 
     std::vector<DynBody *> mDynBodies;
     std::vector<StaticBody *> mStaticBodies;
+    BodyPool<DynBody> mDynBodyPool;
+    BodyPool<StaticBody> mStaticBodyPool;
+    std::vector<BodySlot> mBodySlots;
+    std::vector<uint32_t> mFreeBodySlots;
+    // raw shapes handed to the world, so passing the same one twice shares it
+    std::unordered_map<const Shape *, std::weak_ptr<const Shape>> mAdoptedShapes;
+
+    BroadPhaseType mBroadPhaseType;
+    SweepAndPrune mSweepAndPrune;
+    DynamicTree mDynamicTree;
+    StaticBVH mStaticBVH;
+    bool mStaticBodiesDirty;
+    std::vector<DynPair> mDynPairs;
+    std::vector<StaticPair> mStaticPairs;
+    std::vector<std::vector<StaticBody *>> mStaticCandidates;
+    std::vector<uint8_t> mPairedBodies;
+    RayPacket mRayPacket;
+    DynBVH mRaycastBVH;
+    std::vector<uint32_t> mPacketRays;
+
+    std::unique_ptr<ThreadPool> mThreadPool;
+    std::vector<PreviousTransform> mPreviousTransforms;
+    std::vector<uint32_t> mContinuousBodies;
+    std::vector<MovementEvent> mMovementEvents;
+    bool mMovementEventsBuffered;
+    std::vector<CollisionInfo> mDynContacts;
+    std::vector<CollisionInfo> mStaticContacts;
+    ContactCache mContactCache;
+    std::vector<std::pair<Body *, Body *>> mBegunContacts;
+    std::vector<std::pair<Body *, Body *>> mEndedContacts;
+    std::vector<uint32_t> mIslandParents;
+    std::vector<uint32_t> mIslandIndices;
+    std::vector<ContactRef> mContactRefs;
+    std::vector<ContactRef> mSortedContactRefs;
+    std::vector<uint32_t> mIslandStarts;
+    std::vector<uint32_t> mIslandCursors;
+    std::vector<SolverContact> mSolverContacts;
+    std::vector<SolverVelocity> mSolverVelocities;
+    // never reused, 64 bits do not wrap however many bodies come and go
+    uint64_t mNextBodyId;
+    uint32_t mSleepTicks;
+    uint32_t mSolverIterations;
+
+    Profiler mProfiler;
+    WorldStats mStats;
+    std::atomic<uint64_t> mSphereTests;
+    std::atomic<uint64_t> mRaycastNodeVisits;
 
 
 };
@@ -0,0 +1,259 @@
+#include "PhysWorld.h"
+#include <cmath>
+
+namespace cp {
+
+namespace {
+
+// restitution and friction are set as hundredths
+constexpr double Percent = 0.01;
+// closing velocities slower than this do not bounce, so resting bodies stay at rest
+constexpr double BounceThreshold = 64;
+// share of the penetration beyond the slop removed every step
+constexpr double PositionCorrection = 0.5;
+constexpr double PenetrationSlop = 1;
+
+double dot(const double left[3], const double right[3]) {
+    return left[0] * right[0] + left[1] * right[1] + left[2] * right[2];
+}
+
+void normalize(double vector[3]) {
+    double length = std::sqrt(dot(vector, vector));
+    for (int i = 0; i < 3; ++i) {
+        vector[i] /= length;
+    }
+}
+
+// Two unit vectors orthogonal to normal and to each other
+void tangentBasis(const double normal[3], double first[3], double second[3]) {
+    if (std::abs(normal[0]) >= 0.57735) {
+        first[0] = normal[1];
+        first[1] = -normal[0];
+        first[2] = 0;
+    } else {
+        first[0] = 0;
+        first[1] = normal[2];
+        first[2] = -normal[1];
+    }
+    normalize(first);
+    second[0] = normal[1] * first[2] - normal[2] * first[1];
+    second[1] = normal[2] * first[0] - normal[0] * first[2];
+    second[2] = normal[0] * first[1] - normal[1] * first[0];
+}
+
+}
+
+void PhysWorld::setupSolverContact(const ContactRef &ref, SolverContact &contact) {
+    Body *left;
+    Body *right;
+    const CollisionInfo *info;
+    if (ref.isStatic) {
+        left = mStaticPairs[ref.pair].first;
+        right = mStaticPairs[ref.pair].second;
+        info = &mStaticContacts[ref.pair];
+        contact.left = mStaticPairs[ref.pair].first;
+        contact.right = nullptr;
+    } else {
+        auto &pair = mDynPairs[ref.pair];
+        left = pair.first;
+        right = pair.second;
+        info = &mDynContacts[ref.pair];
+        // a body still asleep is pushed against like a static one and left untouched
+        contact.left = pair.first->isSleeping() ? nullptr : pair.first;
+        contact.right = pair.second->isSleeping() ? nullptr : pair.second;
+    }
+
+    // the narrowphase normal is snapped to the axes, which keeps bodies resting on a row of spheres from
+    // being pushed sideways by the bumps between them. Spheres sharing a center give no direction at all.
+    auto direction = info->normal.isZero() ? Vec3U(0, 1, 0) : info->normal;
+    contact.normal[0] = static_cast<double>(direction.x);
+    contact.normal[1] = static_cast<double>(direction.y);
+    contact.normal[2] = static_cast<double>(direction.z);
+    normalize(contact.normal);
+    tangentBasis(contact.normal, contact.tangents[0], contact.tangents[1]);
+
+    auto inverseMass = [](const DynBody *body) {
+        return body != nullptr && body->getMass() > 0 ? 1.0 / body->getMass() : 0.0;
+    };
+    contact.leftInverseMass = inverseMass(contact.left);
+    contact.rightInverseMass = inverseMass(contact.right);
+    double inverseMassSum = contact.leftInverseMass + contact.rightInverseMass;
+    contact.effectiveMass = inverseMassSum > 0 ? 1 / inverseMassSum : 0;
+
+    contact.friction = std::sqrt(static_cast<double>(std::max(left->getFriction(), 0)) *
+                                 static_cast<double>(std::max(right->getFriction(), 0))) * Percent;
+    double restitution = std::max(left->getRestitution(), right->getRestitution()) * Percent;
+    contact.depth = info->depth;
+    contact.cached = mContactCache.find(left, right);
+
+    // the velocity the contact started with decides the bounce, later iterations aim for it
+    double relative[3] = {0, 0, 0};
+    for (int i = 0; i < 3; ++i) {
+        if (contact.right != nullptr) {
+            relative[i] += static_cast<double>(contact.right->getVelocity()[i]);
+        }
+        if (contact.left != nullptr) {
+            relative[i] -= static_cast<double>(contact.left->getVelocity()[i]);
+        }
+    }
+    double closing = dot(relative, contact.normal);
+    contact.bounce = closing < -BounceThreshold ? -restitution * closing : 0;
+}
+
+void PhysWorld::solveIsland(size_t island) {
+    auto begin = mIslandStarts[island];
+    auto end = mIslandStarts[island + 1];
+
+    auto velocityOf = [this](DynBody *body) -> double * {
+        return mSolverVelocities[body->getIndex()].value;
+    };
+    auto apply = [&velocityOf](SolverContact &contact, const double impulse[3]) {
+        if (contact.left != nullptr) {
+            auto velocity = velocityOf(contact.left);
+            for (int i = 0; i < 3; ++i) {
+                velocity[i] -= impulse[i] * contact.leftInverseMass;
+            }
+        }
+        if (contact.right != nullptr) {
+            auto velocity = velocityOf(contact.right);
+            for (int i = 0; i < 3; ++i) {
+                velocity[i] += impulse[i] * contact.rightInverseMass;
+            }
+        }
+    };
+    auto relativeVelocity = [&velocityOf](const SolverContact &contact, double relative[3]) {
+        for (int i = 0; i < 3; ++i) {
+            relative[i] = (contact.right != nullptr ? velocityOf(contact.right)[i] : 0) -
+                          (contact.left != nullptr ? velocityOf(contact.left)[i] : 0);
+        }
+    };
+
+    for (auto i = begin; i < end; ++i) {
+        auto &contact = mSolverContacts[i];
+        setupSolverContact(mSortedContactRefs[i], contact);
+        for (auto body: {contact.left, contact.right}) {
+            if (body != nullptr) {
+                auto &solverVelocity = mSolverVelocities[body->getIndex()];
+                for (int axis = 0; axis < 3; ++axis) {
+                    solverVelocity.value[axis] = static_cast<double>(body->getVelocity()[axis]);
+                }
+                solverVelocity.friction = 0;
+                solverVelocity.written = false;
+            }
+        }
+    }
+
+    // warm start, the impulses of the last step are brought onto this step's normal and clamped again
+    for (auto i = begin; i < end; ++i) {
+        auto &contact = mSolverContacts[i];
+        const double none[3] = {0, 0, 0};
+        const double *previous = contact.cached != nullptr ? contact.cached->impulse : none;
+        contact.normalImpulse = std::max(dot(previous, contact.normal), 0.0);
+        double limit = contact.friction * contact.normalImpulse;
+        double impulse[3];
+        for (int axis = 0; axis < 3; ++axis) {
+            impulse[axis] = contact.normal[axis] * contact.normalImpulse;
+        }
+        for (int k = 0; k < 2; ++k) {
+            contact.tangentImpulses[k] = std::max(-limit, std::min(dot(previous, contact.tangents[k]), limit));
+            for (int axis = 0; axis < 3; ++axis) {
+                impulse[axis] += contact.tangents[k][axis] * contact.tangentImpulses[k];
+            }
+        }
+        apply(contact, impulse);
+    }
+
+    for (uint32_t iteration = 0; iteration < mSolverIterations; ++iteration) {
+        for (auto i = begin; i < end; ++i) {
+            auto &contact = mSolverContacts[i];
+            double relative[3];
+            double impulse[3];
+
+            // friction first, bounded by the normal impulse so far
+            double limit = contact.friction * contact.normalImpulse;
+            for (int k = 0; k < 2; ++k) {
+                relativeVelocity(contact, relative);
+                double lambda = -dot(relative, contact.tangents[k]) * contact.effectiveMass;
+                double total = std::max(-limit, std::min(contact.tangentImpulses[k] + lambda, limit));
+                lambda = total - contact.tangentImpulses[k];
+                contact.tangentImpulses[k] = total;
+                for (int axis = 0; axis < 3; ++axis) {
+                    impulse[axis] = contact.tangents[k][axis] * lambda;
+                }
+                apply(contact, impulse);
+            }
+
+            // the bodies can only be pushed apart, so the total normal impulse never goes negative
+            relativeVelocity(contact, relative);
+            double lambda = (contact.bounce - dot(relative, contact.normal)) * contact.effectiveMass;
+            double total = std::max(contact.normalImpulse + lambda, 0.0);
+            lambda = total - contact.normalImpulse;
+            contact.normalImpulse = total;
+            for (int axis = 0; axis < 3; ++axis) {
+                impulse[axis] = contact.normal[axis] * lambda;
+            }
+            apply(contact, impulse);
+        }
+    }
+
+    for (auto i = begin; i < end; ++i) {
+        auto &contact = mSolverContacts[i];
+        for (auto body: {contact.left, contact.right}) {
+            if (body != nullptr) {
+                auto &solverVelocity = mSolverVelocities[body->getIndex()];
+                solverVelocity.friction = std::max(solverVelocity.friction, contact.friction);
+            }
+        }
+    }
+
+    for (auto i = begin; i < end; ++i) {
+        auto &contact = mSolverContacts[i];
+        for (auto body: {contact.left, contact.right}) {
+            if (body == nullptr || mSolverVelocities[body->getIndex()].written) {
+                continue;
+            }
+            auto &solverVelocity = mSolverVelocities[body->getIndex()];
+            solverVelocity.written = true;
+            auto velocity = solverVelocity.value;
+            body->mVelocity = Vec3U(std::llround(velocity[0]), std::llround(velocity[1]), std::llround(velocity[2]));
+            // contacts do not turn bodies, friction slows down the spin instead, however many contacts there are
+            double damping = std::max(0.0, std::min(1 - solverVelocity.friction, 1.0));
+            auto angular = body->mAngularVelocity;
+            body->mAngularVelocity = Vec3U(static_cast<Unit>(angular.x * damping),
+                                           static_cast<Unit>(angular.y * damping),
+                                           static_cast<Unit>(angular.z * damping));
+        }
+
+        if (contact.cached != nullptr) {
+            for (int axis = 0; axis < 3; ++axis) {
+                contact.cached->impulse[axis] = contact.normal[axis] * contact.normalImpulse +
+                                                contact.tangents[0][axis] * contact.tangentImpulses[0] +
+                                                contact.tangents[1][axis] * contact.tangentImpulses[1];
+            }
+        }
+    }
+
+    // push the bodies out of each other, only part of the way so stacks do not overshoot
+    for (auto i = begin; i < end; ++i) {
+        auto &contact = mSolverContacts[i];
+        double correction = PositionCorrection * std::max(static_cast<double>(contact.depth) - PenetrationSlop, 0.0) *
+                            contact.effectiveMass;
+        if (correction <= 0) {
+            continue;
+        }
+        auto move = [&contact, correction](DynBody *body, double share) {
+            auto offset = Vec3U(std::llround(contact.normal[0] * correction * share),
+                                std::llround(contact.normal[1] * correction * share),
+                                std::llround(contact.normal[2] * correction * share));
+            body->movePos(body->getPos() + offset);
+        };
+        if (contact.left != nullptr) {
+            move(contact.left, -contact.leftInverseMass);
+        }
+        if (contact.right != nullptr) {
+            move(contact.right, contact.rightInverseMass);
+        }
+    }
+}
+
+}
@@ -0,0 +1,175 @@
+#include "PhysWorld.h"
+#include "serial/ByteStream.h"
+
+namespace cp {
+
+namespace {
+
+constexpr uint32_t StateMagic = 0x53575043; // "CPWS"
+constexpr uint32_t StateVersion = 2;
+
+constexpr size_t HandleSize = 2 * sizeof(uint32_t);
+constexpr size_t HeaderSize = 2 * sizeof(uint32_t) + sizeof(uint64_t) + 3 * sizeof(uint32_t);
+constexpr size_t DynRecordSize = HandleSize + 9 * sizeof(Unit) + 3 * sizeof(SmallUnit) + sizeof(uint32_t) + 1;
+constexpr size_t StaticRecordSize = HandleSize + 3 * sizeof(Unit) + 3 * sizeof(SmallUnit);
+constexpr size_t ContactRecordSize = 2 * HandleSize + 7 * sizeof(Unit) + 2 * sizeof(int32_t) + 1 +
+                                     sizeof(uint64_t) + 3 * sizeof(double);
+
+void writeHandle(ByteWriter &writer, BodyHandle handle) {
+    writer.write(handle.index);
+    writer.write(handle.generation);
+}
+
+bool readHandle(ByteReader &reader, BodyHandle &handle) {
+    return reader.read(handle.index) && reader.read(handle.generation);
+}
+
+}
+
+void PhysWorld::saveState(std::vector<uint8_t> &buffer) const {
+    std::vector<const ContactPair *> contacts;
+    mContactCache.getSortedPairs(contacts);
+
+    buffer.clear();
+    ByteWriter writer(buffer);
+    writer.reserve(HeaderSize + mDynBodies.size() * DynRecordSize + mStaticBodies.size() * StaticRecordSize +
+                   contacts.size() * ContactRecordSize);
+
+    writer.write(StateMagic);
+    writer.write(StateVersion);
+    writer.write(mContactCache.getTick());
+    writer.write(static_cast<uint32_t>(mDynBodies.size()));
+    writer.write(static_cast<uint32_t>(mStaticBodies.size()));
+    writer.write(static_cast<uint32_t>(contacts.size()));
+
+    for (auto body: mDynBodies) {
+        writeHandle(writer, body->mHandle);
+        writer.writeVec(body->mPosition);
+        writer.writeVec(body->mRotation);
+        writer.writeVec(body->mVelocity);
+        writer.writeVec(body->mAngularVelocity);
+        writer.write(body->mRestTicks);
+        writer.write(static_cast<uint8_t>(body->mSleeping));
+    }
+
+    for (auto body: mStaticBodies) {
+        writeHandle(writer, body->mHandle);
+        writer.writeVec(body->mPosition);
+        writer.writeVec(body->mRotation);
+    }
+
+    for (auto pair: contacts) {
+        writeHandle(writer, pair->left->mHandle);
+        writeHandle(writer, pair->right->mHandle);
+        writer.write(pair->depth);
+        writer.writeVec(pair->normal);
+        writer.writeVec(pair->contact);
+        writer.write(pair->leftSphere);
+        writer.write(pair->rightSphere);
+        writer.write(static_cast<uint8_t>(pair->isStatic));
+        writer.write(pair->tick);
+        for (auto value: pair->impulse) {
+            writer.write(value);
+        }
+    }
+}
+
+bool PhysWorld::loadState(const uint8_t *data, size_t size) {
+    ByteReader header(data, size);
+    uint32_t magic = 0, version = 0, dynCount = 0, staticCount = 0, contactCount = 0;
+    uint64_t tick = 0;
+    if (!header.read(magic) || !header.read(version) || !header.read(tick) || !header.read(dynCount) ||
+        !header.read(staticCount) || !header.read(contactCount)) {
+        return false;
+    }
+    if (magic != StateMagic || version != StateVersion || dynCount != mDynBodies.size() ||
+        staticCount != mStaticBodies.size()) {
+        return false;
+    }
+    if (header.getRemaining() != dynCount * DynRecordSize + staticCount * StaticRecordSize +
+                                 contactCount * ContactRecordSize) {
+        return false;
+    }
+
+    // the first pass only checks every handle still names the same body, the second one writes
+    for (int pass = 0; pass < 2; ++pass) {
+        bool apply = pass == 1;
+        ByteReader reader(data + header.getOffset(), header.getRemaining());
+        BodyHandle handle;
+
+        for (auto body: mDynBodies) {
+            Vec3U pos, velocity, angularVelocity;
+            Vec3Small rotation;
+            uint32_t restTicks = 0;
+            uint8_t sleeping = 0;
+            readHandle(reader, handle);
+            reader.readVec(pos);
+            reader.readVec(rotation);
+            reader.readVec(velocity);
+            reader.readVec(angularVelocity);
+            reader.read(restTicks);
+            reader.read(sleeping);
+            if (handle != body->mHandle) {
+                return false;
+            }
+            if (apply) {
+                body->movePos(pos);
+                body->setRotation(rotation);
+                body->mVelocity = velocity;
+                body->mAngularVelocity = angularVelocity;
+                body->mRestTicks = restTicks;
+                body->mSleeping = sleeping != 0;
+            }
+        }
+
+        for (auto body: mStaticBodies) {
+            Vec3U pos;
+            Vec3Small rotation;
+            readHandle(reader, handle);
+            reader.readVec(pos);
+            reader.readVec(rotation);
+            if (handle != body->mHandle) {
+                return false;
+            }
+            if (apply && (pos != body->mPosition || rotation != body->mRotation)) {
+                body->movePos(pos);
+                body->setRotation(rotation);
+                mStaticBodiesDirty = true;
+            }
+        }
+
+        if (apply) {
+            mContactCache.reset(tick);
+        }
+        for (uint32_t i = 0; i < contactCount; ++i) {
+            BodyHandle rightHandle;
+            ContactPair pair;
+            uint8_t isStatic = 0;
+            readHandle(reader, handle);
+            readHandle(reader, rightHandle);
+            reader.read(pair.depth);
+            reader.readVec(pair.normal);
+            reader.readVec(pair.contact);
+            reader.read(pair.leftSphere);
+            reader.read(pair.rightSphere);
+            reader.read(isStatic);
+            reader.read(pair.tick);
+            for (auto &value: pair.impulse) {
+                reader.read(value);
+            }
+            pair.left = getBody(handle);
+            pair.right = getBody(rightHandle);
+            pair.isStatic = isStatic != 0;
+            if (pair.left == nullptr || pair.right == nullptr) {
+                return false;
+            }
+            if (apply) {
+                mContactCache.insert(pair);
+            }
+        }
+    }
+
+    return true;
+}
+
+}
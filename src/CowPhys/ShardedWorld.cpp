@@ -0,0 +1,371 @@
+#include "ShardedWorld.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace cp {
+
+ShardedWorld::ShardedWorld(const ShardedWorldSettings &settings) : mSettings(settings), mDynBodyCount(0),
+                                                                   mGhostCount(0) {
+    mSettings.columns = std::max(mSettings.columns, 1u);
+    mSettings.rows = std::max(mSettings.rows, 1u);
+    mSettings.regionSize = std::max<Unit>(mSettings.regionSize, 1);
+
+    mShards.resize(static_cast<size_t>(mSettings.columns) * mSettings.rows);
+    for (auto &shard: mShards) {
+        shard.world.reset(new PhysWorld());
+    }
+    auto threadCount = mSettings.threadCount > 0 ? mSettings.threadCount : static_cast<int>(mShards.size());
+    mThreadPool.reset(new ThreadPool(threadCount));
+}
+
+void ShardedWorld::update() {
+    syncGhosts();
+
+    // the shards share nothing, each of them is stepped by a single thread
+    mThreadPool->parallelEach(mShards.size(), [this](size_t i) {
+        mShards[i].world->update();
+        scanShard(static_cast<uint32_t>(i));
+    });
+
+    // the shards are changed one after the other, in the same order whatever the thread count
+    for (auto &shard: mShards) {
+        for (auto slot: shard.changed) {
+            updateBody(slot);
+        }
+        shard.changed.clear();
+    }
+}
+
+BodyHandle ShardedWorld::createDynBody(std::shared_ptr<const Shape> shape, Vec3U pos) {
+    auto handle = allocateSlot();
+    auto &slot = mBodySlots[handle.index];
+    slot.isStatic = false;
+    slot.shard = shardOf(pos);
+
+    auto &shard = mShards[slot.shard];
+    auto body = shard.world->createDynBody(std::move(shape), pos);
+    shard.dynSlots.push_back(handle.index);
+    slot.handle = body->getHandle();
+    ++mDynBodyCount;
+
+    updateBody(handle.index);
+    return handle;
+}
+
+BodyHandle ShardedWorld::createStaticBody(std::shared_ptr<const Shape> shape, Vec3U pos) {
+    auto handle = allocateSlot();
+    auto &slot = mBodySlots[handle.index];
+    slot.isStatic = true;
+    slot.shard = shardOf(pos);
+
+    auto &owner = mShards[slot.shard];
+    auto body = owner.world->createStaticBody(shape, pos);
+    owner.staticSlots.push_back(handle.index);
+    slot.handle = body->getHandle();
+    slot.range = rangeOf(body->getWorldAABB());
+
+    for (auto column = slot.range.minColumn; column <= slot.range.maxColumn; ++column) {
+        for (auto row = slot.range.minRow; row <= slot.range.maxRow; ++row) {
+            auto index = column * mSettings.rows + row;
+            if (index == slot.shard) {
+                continue;
+            }
+            auto &shard = mShards[index];
+            // the copies share the world spheres of the body, a terrain is only transformed and kept once
+            auto copy = shard.world->createStaticCopy(*body);
+            shard.staticSlots.push_back(handle.index);
+            slot.copies.emplace_back(index, copy->getHandle());
+        }
+    }
+    return handle;
+}
+
+bool ShardedWorld::destroyBody(BodyHandle handle) {
+    if (getBody(handle) == nullptr) {
+        return false;
+    }
+
+    auto &slot = mBodySlots[handle.index];
+    destroyIn(slot.shard, slot.handle);
+    for (auto &copy: slot.copies) {
+        destroyIn(copy.first, copy.second);
+    }
+    if (!slot.isStatic) {
+        --mDynBodyCount;
+        mGhostCount -= slot.copies.size();
+    }
+    slot.copies.clear();
+    if (slot.ghosted != NotGhosted) {
+        mBodySlots[mGhostedSlots.back()].ghosted = slot.ghosted;
+        mGhostedSlots[slot.ghosted] = mGhostedSlots.back();
+        mGhostedSlots.pop_back();
+        slot.ghosted = NotGhosted;
+    }
+    slot.used = false;
+    // zero is kept for handles that were never set
+    if (++slot.generation == 0) {
+        slot.generation = 1;
+    }
+    mFreeBodySlots.push_back(handle.index);
+    return true;
+}
+
+Body *ShardedWorld::getBody(BodyHandle handle) const {
+    if (handle.index >= mBodySlots.size() || !mBodySlots[handle.index].used ||
+        mBodySlots[handle.index].generation != handle.generation) {
+        return nullptr;
+    }
+    auto &slot = mBodySlots[handle.index];
+    return mShards[slot.shard].world->getBody(slot.handle);
+}
+
+ShardedRaycast ShardedWorld::raycast(Vec3U pos, Vec3U dir, uint32_t mask) {
+    mRayShards.clear();
+    for (uint32_t i = 0; i < mShards.size(); ++i) {
+        double enter;
+        if (rayEnters(i, pos, dir, enter)) {
+            mRayShards.emplace_back(enter, i);
+        }
+    }
+    std::sort(mRayShards.begin(), mRayShards.end());
+
+    ShardedRaycast result;
+    result.hit = WorldRaycast();
+    result.hit.body = nullptr;
+    result.hit.distance = std::numeric_limits<Unit>::max();
+    result.shard = 0;
+    for (auto &rayShard: mRayShards) {
+        // a region entered past the closest hit cannot hold a closer one
+        if (result.hit.body != nullptr && rayShard.first > static_cast<double>(result.hit.distance)) {
+            break;
+        }
+
+        auto hit = mShards[rayShard.second].world->raycast(pos, dir, nullptr, mask);
+        if (hit.body == nullptr || (result.hit.body != nullptr && hit.distance >= result.hit.distance)) {
+            continue;
+        }
+        auto slot = slotOf(rayShard.second, hit.body);
+        result.hit = hit;
+        result.handle = {slot, mBodySlots[slot].generation};
+        result.shard = rayShard.second;
+    }
+    return result;
+}
+
+void ShardedWorld::applyForceToAllDynBodies(Vec3U force) {
+    for (auto &shard: mShards) {
+        shard.world->applyForceToAllDynBodies(force);
+    }
+}
+
+uint32_t ShardedWorld::columnOf(Unit x) const {
+    auto column = std::floor(static_cast<double>(x - mSettings.origin.x) / static_cast<double>(mSettings.regionSize));
+    return static_cast<uint32_t>(std::max(0.0, std::min(column, static_cast<double>(mSettings.columns - 1))));
+}
+
+uint32_t ShardedWorld::rowOf(Unit z) const {
+    auto row = std::floor(static_cast<double>(z - mSettings.origin.z) / static_cast<double>(mSettings.regionSize));
+    return static_cast<uint32_t>(std::max(0.0, std::min(row, static_cast<double>(mSettings.rows - 1))));
+}
+
+ShardedWorld::ShardRange ShardedWorld::rangeOf(const AABB<Unit> &aabb) const {
+    auto margin = mSettings.ghostMargin;
+    return {columnOf(aabb.getMin().x - margin), columnOf(aabb.getMax().x + margin),
+            rowOf(aabb.getMin().z - margin), rowOf(aabb.getMax().z + margin)};
+}
+
+bool ShardedWorld::rayEnters(uint32_t shard, const Vec3U &pos, const Vec3U &dir, double &enter) const {
+    const uint32_t cells[2] = {shard / mSettings.rows, shard % mSettings.rows};
+    const uint32_t counts[2] = {mSettings.columns, mSettings.rows};
+    const Unit origins[2] = {mSettings.origin.x, mSettings.origin.z};
+    const Unit starts[2] = {pos.x, pos.z};
+    const Unit directions[2] = {dir.x, dir.z};
+    auto size = static_cast<double>(mSettings.regionSize);
+    auto infinity = std::numeric_limits<double>::infinity();
+
+    double tMin = 0;
+    double tMax = infinity;
+    for (int i = 0; i < 2; ++i) {
+        // the bounds are taken relative to the ray start so large coordinates keep their precision
+        auto offset = static_cast<double>(origins[i] - starts[i]);
+        double min = cells[i] == 0 ? -infinity : offset + cells[i] * size;
+        double max = cells[i] + 1 == counts[i] ? infinity : offset + (cells[i] + 1) * size;
+        if (directions[i] == 0) {
+            if (0 < min || 0 >= max) {
+                return false;
+            }
+            continue;
+        }
+
+        double inv = 1.0 / static_cast<double>(directions[i]);
+        double near = min * inv;
+        double far = max * inv;
+        if (near > far) {
+            std::swap(near, far);
+        }
+        tMin = std::max(tMin, near);
+        tMax = std::min(tMax, far);
+        if (tMin > tMax) {
+            return false;
+        }
+    }
+
+    enter = tMin;
+    return true;
+}
+
+BodyHandle ShardedWorld::allocateSlot() {
+    BodyHandle handle;
+    if (mFreeBodySlots.empty()) {
+        handle.index = static_cast<uint32_t>(mBodySlots.size());
+        mBodySlots.push_back({1, false, false, 0, BodyHandle(), {0, 0, 0, 0}, {}, NotGhosted});
+    } else {
+        handle.index = mFreeBodySlots.back();
+        mFreeBodySlots.pop_back();
+    }
+
+    auto &slot = mBodySlots[handle.index];
+    slot.used = true;
+    handle.generation = slot.generation;
+    return handle;
+}
+
+DynBody *ShardedWorld::createCopy(uint32_t shard, uint32_t slot, DynBody &from) {
+    auto body = mShards[shard].world->createDynBody(from.getSharedShape(), from.getPos());
+    copySettings(from, *body);
+    copyState(from, *body);
+    mShards[shard].dynSlots.push_back(slot);
+    return body;
+}
+
+void ShardedWorld::destroyIn(uint32_t shard, BodyHandle handle) {
+    auto &world = *mShards[shard].world;
+    auto body = world.getBody(handle);
+    // the world moves its last body into the freed index, the slots follow along
+    auto &slots = world.getDynBody(handle) != nullptr ? mShards[shard].dynSlots : mShards[shard].staticSlots;
+    slots[body->getIndex()] = slots.back();
+    slots.pop_back();
+    world.destroyBody(handle);
+}
+
+uint32_t ShardedWorld::slotOf(uint32_t shard, Body *body) const {
+    auto &world = *mShards[shard].world;
+    bool isDynamic = world.getDynBody(body->getHandle()) != nullptr;
+    return (isDynamic ? mShards[shard].dynSlots : mShards[shard].staticSlots)[body->getIndex()];
+}
+
+void ShardedWorld::syncGhosts() {
+    for (auto index: mGhostedSlots) {
+        auto &slot = mBodySlots[index];
+        auto body = mShards[slot.shard].world->getDynBody(slot.handle);
+        // settings are made on the owner after the ghosts exist, they are brought over even while it sleeps
+        for (auto &copy: slot.copies) {
+            copySettings(*body, *mShards[copy.first].world->getDynBody(copy.second));
+        }
+        // a sleeping owner leaves its ghosts asleep as well, moving them would wake them
+        if (body->isSleeping()) {
+            continue;
+        }
+        for (auto &copy: slot.copies) {
+            copyState(*body, *mShards[copy.first].world->getDynBody(copy.second));
+        }
+    }
+}
+
+void ShardedWorld::scanShard(uint32_t shard) {
+    auto &bodies = mShards[shard].world->getDynBodies();
+    auto &slots = mShards[shard].dynSlots;
+    for (size_t i = 0; i < bodies.size(); ++i) {
+        auto body = bodies[i];
+        auto &slot = mBodySlots[slots[i]];
+        // ghosts are handled by their owner. Sleeping bodies are checked too, the solver may have
+        // moved them on the step they fell asleep.
+        if (slot.shard != shard) {
+            continue;
+        }
+        if (shardOf(body->getPos()) != shard || rangeOf(body->getWorldAABB()) != slot.range) {
+            mShards[shard].changed.push_back(slots[i]);
+        }
+    }
+}
+
+void ShardedWorld::updateBody(uint32_t index) {
+    auto &slot = mBodySlots[index];
+    auto body = mShards[slot.shard].world->getDynBody(slot.handle);
+
+    // a body crossing over is created anew in the next shard, its ghost there is not needed anymore
+    auto target = shardOf(body->getPos());
+    if (target != slot.shard) {
+        for (size_t i = 0; i < slot.copies.size(); ++i) {
+            if (slot.copies[i].first == target) {
+                destroyIn(target, slot.copies[i].second);
+                slot.copies[i] = slot.copies.back();
+                slot.copies.pop_back();
+                --mGhostCount;
+                break;
+            }
+        }
+        auto moved = createCopy(target, index, *body);
+        destroyIn(slot.shard, slot.handle);
+        slot.shard = target;
+        slot.handle = moved->getHandle();
+        body = moved;
+    }
+
+    slot.range = rangeOf(body->getWorldAABB());
+    for (size_t i = 0; i < slot.copies.size();) {
+        if (!inRange(slot.range, slot.copies[i].first)) {
+            destroyIn(slot.copies[i].first, slot.copies[i].second);
+            slot.copies[i] = slot.copies.back();
+            slot.copies.pop_back();
+            --mGhostCount;
+        } else {
+            ++i;
+        }
+    }
+    for (auto column = slot.range.minColumn; column <= slot.range.maxColumn; ++column) {
+        for (auto row = slot.range.minRow; row <= slot.range.maxRow; ++row) {
+            auto shard = column * mSettings.rows + row;
+            bool found = shard == slot.shard;
+            for (auto &copy: slot.copies) {
+                found = found || copy.first == shard;
+            }
+            if (!found) {
+                slot.copies.emplace_back(shard, createCopy(shard, index, *body)->getHandle());
+                ++mGhostCount;
+            }
+        }
+    }
+
+    if (slot.copies.empty() && slot.ghosted != NotGhosted) {
+        mBodySlots[mGhostedSlots.back()].ghosted = slot.ghosted;
+        mGhostedSlots[slot.ghosted] = mGhostedSlots.back();
+        mGhostedSlots.pop_back();
+        slot.ghosted = NotGhosted;
+    } else if (!slot.copies.empty() && slot.ghosted == NotGhosted) {
+        slot.ghosted = static_cast<uint32_t>(mGhostedSlots.size());
+        mGhostedSlots.push_back(index);
+    }
+}
+
+void ShardedWorld::copySettings(DynBody &from, DynBody &to) {
+    to.setMass(from.getMass());
+    to.setRestitution(from.getRestitution());
+    to.setFriction(from.getFriction());
+    to.setDrag(from.getDrag());
+    to.setRotationAllowed(from.isRotationAllowed());
+    to.setContinuousCollision(from.hasContinuousCollision());
+    to.setCollisionFilter(from.getCategory(), from.getCollisionMask());
+    to.setIgnoreGroup(from.getIgnoreGroup());
+    to.setUserData(from.getUserData());
+}
+
+void ShardedWorld::copyState(DynBody &from, DynBody &to) {
+    to.setPos(from.getPos());
+    to.setRotation(from.getRotation());
+    to.setVelocity(from.getVelocity());
+    to.setAngularVelocity(from.getAngularVelocity());
+}
+
+}
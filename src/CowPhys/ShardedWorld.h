@@ -0,0 +1,202 @@
+#ifndef COWPHYS_SHARDEDWORLD_H
+#define COWPHYS_SHARDEDWORLD_H
+
+#include <memory>
+#include <utility>
+#include <vector>
+#include "PhysWorld.h"
+
+namespace cp {
+
+// Split of the world into a grid of square regions on the x and z axes. The regions of the outer
+// columns and rows reach to infinity, so every position belongs to one of them.
+struct ShardedWorldSettings {
+    Vec3U origin; // corner of the region in the first column and row
+    Unit regionSize = 100000;
+    uint32_t columns = 2; // along x
+    uint32_t rows = 2; // along z
+    // bodies closer than this to a neighbouring region are ghosted into it
+    Unit ghostMargin = 1000;
+    // threads stepping the shards, 0 gives every shard its own
+    int threadCount = 0;
+};
+
+struct ShardedRaycast {
+    // body points into the shard the ray was cast in, it may be a ghost or a static replica
+    WorldRaycast hit;
+    BodyHandle handle;
+    uint32_t shard;
+};
+
+// Steps every region of a large world as its own PhysWorld, on its own thread. A DynBody belongs to
+// the shard holding its position and is handed off to the next shard when it crosses over, which
+// starts its contacts over. Near a border it is also copied as a ghost into the neighbouring shards,
+// where it is put back where its owner is before every step, so the bodies on both sides collide with
+// each other. Static bodies are copied into every shard they reach, the copies share the world space
+// spheres of the body so a terrain is kept once however many shards it spans. Bodies are known by
+// handles of the ShardedWorld, the DynBody behind a handle changes whenever the body is handed off.
+// Settings such as the mass or the collision filter are made on the owner and reach its ghosts on the
+// next update.
+// A step never depends on the thread count, but it does on the grid: bodies touching across a border
+// each push against a ghost of the other, and hand offs start contacts over.
+class ShardedWorld {
+
+public:
+
+    static constexpr uint32_t NoShard = 0xffffffff;
+
+    explicit ShardedWorld(const ShardedWorldSettings &settings);
+
+    ShardedWorld(const ShardedWorld &) = delete;
+
+    ShardedWorld &operator=(const ShardedWorld &) = delete;
+
+    // Brings the ghosts to their owners, steps every shard and hands off the bodies that left their region.
+    // Ghosts and hand offs only cost something for the bodies near a border.
+    void update();
+
+    BodyHandle createDynBody(std::shared_ptr<const Shape> shape, Vec3U pos);
+
+    // Static bodies must not be moved once created, their copies in the other shards would stay behind
+    BodyHandle createStaticBody(std::shared_ptr<const Shape> shape, Vec3U pos);
+
+    // Removes the body along with its ghosts or copies, returns false for a stale handle
+    bool destroyBody(BodyHandle handle);
+
+    // The body in the shard owning it, nullptr for a stale handle
+    Body *getBody(BodyHandle handle) const;
+
+    DynBody *getDynBody(BodyHandle handle) const {
+        auto body = getBody(handle);
+        return body != nullptr && !mBodySlots[handle.index].isStatic ? static_cast<DynBody *>(body) : nullptr;
+    }
+
+    // Shard owning the body, or the shard holding the position of a static body, NoShard for a stale handle
+    uint32_t getShardOf(BodyHandle handle) const {
+        return getBody(handle) != nullptr ? mBodySlots[handle.index].shard : NoShard;
+    }
+
+    // Every shard is asked in the order the ray enters their region, until a hit is closer than the next region
+    ShardedRaycast raycast(Vec3U pos, Vec3U dir, uint32_t mask = Body::AllCategories);
+
+    // Applies the force to every awake DynBody of every shard
+    void applyForceToAllDynBodies(Vec3U force);
+
+    // Shards are laid out column after column, settings like the sleep ticks are made on each of them
+    PhysWorld &getShard(size_t shard) {
+        return *mShards[shard].world;
+    }
+
+    size_t getShardCount() const {
+        return mShards.size();
+    }
+
+    // Dynamic bodies owned by the shards, ghosts left out
+    size_t getDynBodyCount() const {
+        return mDynBodyCount;
+    }
+
+    size_t getGhostCount() const {
+        return mGhostCount;
+    }
+
+private:
+
+    // Columns and rows of the shards a body reaches, its ghost margin included
+    struct ShardRange {
+        uint32_t minColumn;
+        uint32_t maxColumn;
+        uint32_t minRow;
+        uint32_t maxRow;
+
+        bool operator==(const ShardRange &rhs) const {
+            return minColumn == rhs.minColumn && maxColumn == rhs.maxColumn && minRow == rhs.minRow &&
+                   maxRow == rhs.maxRow;
+        }
+
+        bool operator!=(const ShardRange &rhs) const {
+            return !(*this == rhs);
+        }
+    };
+
+    struct Shard {
+        std::unique_ptr<PhysWorld> world;
+        // global slot of every body of the shard, ghosts and static copies included, in the same order as
+        // the body lists of the world
+        std::vector<uint32_t> dynSlots;
+        std::vector<uint32_t> staticSlots;
+        // owned bodies that left the region or the shards they reach during the last step
+        std::vector<uint32_t> changed;
+    };
+
+    struct BodySlot {
+        uint32_t generation;
+        bool used;
+        bool isStatic;
+        uint32_t shard;
+        BodyHandle handle;
+        ShardRange range;
+        // ghosts of a DynBody or copies of a static body, by shard
+        std::vector<std::pair<uint32_t, BodyHandle>> copies;
+        // position in mGhostedSlots while the body has ghosts
+        uint32_t ghosted;
+    };
+
+    static constexpr uint32_t NotGhosted = 0xffffffff;
+
+    uint32_t columnOf(Unit x) const;
+
+    uint32_t rowOf(Unit z) const;
+
+    uint32_t shardOf(const Vec3U &pos) const {
+        return columnOf(pos.x) * mSettings.rows + rowOf(pos.z);
+    }
+
+    ShardRange rangeOf(const AABB<Unit> &aabb) const;
+
+    bool inRange(const ShardRange &range, uint32_t shard) const {
+        auto column = shard / mSettings.rows;
+        auto row = shard % mSettings.rows;
+        return column >= range.minColumn && column <= range.maxColumn && row >= range.minRow && row <= range.maxRow;
+    }
+
+    // Distance along the ray at which it enters the region of the shard, false when it misses it
+    bool rayEnters(uint32_t shard, const Vec3U &pos, const Vec3U &dir, double &enter) const;
+
+    BodyHandle allocateSlot();
+
+    DynBody *createCopy(uint32_t shard, uint32_t slot, DynBody &from);
+
+    void destroyIn(uint32_t shard, BodyHandle handle);
+
+    // Global slot of a body of the shard, owned or not
+    uint32_t slotOf(uint32_t shard, Body *body) const;
+
+    // Puts the ghosts back where their owner is, before the step
+    void syncGhosts();
+
+    // Lists the owned bodies of the shard whose region or reached shards changed, run by the shard thread
+    void scanShard(uint32_t shard);
+
+    // Hands the body off to the shard holding its position and brings its ghosts to the shards it reaches
+    void updateBody(uint32_t slot);
+
+    static void copySettings(DynBody &from, DynBody &to);
+
+    static void copyState(DynBody &from, DynBody &to);
+
+    ShardedWorldSettings mSettings;
+    std::vector<Shard> mShards;
+    std::vector<BodySlot> mBodySlots;
+    std::vector<uint32_t> mFreeBodySlots;
+    std::unique_ptr<ThreadPool> mThreadPool;
+    std::vector<uint32_t> mGhostedSlots;
+    std::vector<std::pair<double, uint32_t>> mRayShards;
+    size_t mDynBodyCount;
+    size_t mGhostCount;
+
+};
+
+}
+
+#endif //COWPHYS_SHARDEDWORLD_H
@@ -1,37 +1,59 @@
 #ifndef COWPHYS_BODY_H
 #define COWPHYS_BODY_H
 
+#include <memory>
 #include <vector>
 #include <iostream>
+#include <limits>
 #include "CowPhys/math/Vec3.h"
 #include "CowPhys/math/AABB.h"
+#include "CowPhys/math/Rotation.h"
 #include "CowPhys/shape/Shape.h"
 #include "CowPhys/shape/BoxShape.h"
 #include "CowPhys/shape/MeshShape.h"
 #include "CowPhys/shape/CompShape.h"
+#include "CowPhys/simd/SphereKernel.h"
+#include "CowPhys/profile/Profiler.h"
 #include "Collision.h"
+#include "BodyHandle.h"
 
 namespace cp {
 
 class Body {
 public:
 
-    explicit Body(Shape *shape) : mShape(shape), mMass(1), mRestitution(1),
-                                  mFriction(1), mRotation(), mUserData(nullptr) {
+    static constexpr uint32_t AllCategories = 0xffffffff;
+
+    // Half the speed along a contact can be lost to friction by default, and bodies do not bounce
+    static constexpr SmallUnit DefaultFriction = 50;
+    static constexpr SmallUnit DefaultRestitution = 0;
+
+    explicit Body(std::shared_ptr<const Shape> shape) : mShape(std::move(shape)), mMass(1),
+                                  mRestitution(DefaultRestitution), mFriction(DefaultFriction), mRotation(),
+                                  mUserData(nullptr), mWorldBoundsVersion(0), mWorldBoundsValid(false) {
     }
 
+    virtual ~Body() = default;
+
     virtual void update() {
         for (auto &collision: mCollisions) {
             collision.update();
         }
     }
 
-    Shape *getShape() {
+    const Shape *getShape() const {
+        return mShape.get();
+    }
+
+    // The shape can be shared by many bodies, it is freed with the last of them
+    const std::shared_ptr<const Shape> &getSharedShape() const {
         return mShape;
     }
 
+    // Teleports the body, which wakes it up
     void setPos(const Vec3U &pos) {
         mPosition = pos;
+        wake();
     }
 
     Vec3U getPos() const {
@@ -47,13 +69,22 @@ public:
     }
 
     void setRotation(const Vec3Small &rotation) {
-        mRotation = rotation;
+        if (rotation != mRotation) {
+            mRotation = rotation;
+            mRotationMatrix = RotationMatrix::fromEuler(rotation);
+        }
+    }
+
+    const RotationMatrix &getRotationMatrix() const {
+        return mRotationMatrix;
     }
 
     Vec3Small getRotation() const {
         return mRotation;
     }
 
+    // Restitution and friction are hundredths, 100 stands for a coefficient of 1. A contact bounces by the
+    // higher restitution of its two bodies, 100 keeping all of the closing speed.
     void setRestitution(SmallUnit restitution) {
         mRestitution = restitution;
     }
@@ -62,6 +93,12 @@ public:
         return mRestitution;
     }
 
+    // A contact takes the geometric mean of the frictions of its two bodies. It bounds the impulse along the
+    // contact to that part of the one pushing the bodies apart, and slows the spin of the bodies by as much.
+    void setFriction(SmallUnit friction) {
+        mFriction = friction;
+    }
+
     SmallUnit getFriction() const {
         return mFriction;
     }
@@ -74,17 +111,192 @@ public:
         return mUserData;
     }
 
-    bool raycast(Vec3U pos, Vec3U dir, Unit &t) {
+    // Brings the world box and bounding sphere up to date, along with the world spheres while the body holds
+    // them. Only does something when the body moved or rotated since the last call.
+    void updateWorldSpheres() {
+        bool boundsCurrent = mWorldBoundsValid && mWorldBoundsPos == mPosition && mWorldBoundsRotation == mRotation &&
+                             mWorldBoundsVersion == mShape->getVersion();
+        bool spheresCurrent = mWorldSpheres == nullptr || isCurrent(*mWorldSpheres);
+        if (boundsCurrent && spheresCurrent) {
+            return;
+        }
+
+        WorldSpheres *target = nullptr;
+        if (!spheresCurrent) {
+            if (mWorldSpheres.use_count() > 1) {
+                // the copy is shared with the replicas of a static body, they keep theirs
+                mWorldSpheres = std::make_shared<WorldSpheres>();
+            }
+            target = mWorldSpheres.get();
+        }
+
+        auto spheres = mShape->getSpheres();
+        Vec3U min(std::numeric_limits<Unit>::max());
+        Vec3U max(std::numeric_limits<Unit>::min());
+        if (target != nullptr) {
+            target->spheres.resize(spheres.size());
+            target->arrays.resize(spheres.size());
+        }
+        for (size_t i = 0; i < spheres.size(); ++i) {
+            auto sphere = spheres[i];
+            sphere.rotateBy(mRotationMatrix);
+            sphere.moveBy(mPosition);
+            if (target != nullptr) {
+                target->spheres[i] = sphere;
+                target->arrays.set(i, sphere);
+            }
+
+            Vec3U radius(sphere.getRadius());
+            min = min.min(sphere.getPosition() - radius);
+            max = max.max(sphere.getPosition() + radius);
+        }
+
+        if (spheres.empty()) {
+            // shapes without spheres, like meshes, only have their local box to go by
+            auto &local = mShape->getAABB();
+            for (int corner = 0; corner < 8; ++corner) {
+                Vec3U offset((corner & 1) ? local.halfSize.x : -local.halfSize.x,
+                             (corner & 2) ? local.halfSize.y : -local.halfSize.y,
+                             (corner & 4) ? local.halfSize.z : -local.halfSize.z);
+                auto point = mRotationMatrix.apply(local.pos + offset) + mPosition;
+                min = min.min(point);
+                max = max.max(point);
+            }
+        }
+        mWorldAABB = AABB<Unit>::fromMinMax(min, max);
+        mWorldBoundingSphere = mShape->getBoundingSphere();
+        mWorldBoundingSphere.rotateBy(mRotationMatrix);
+        mWorldBoundingSphere.moveBy(mPosition);
+        mWorldBoundsPos = mPosition;
+        mWorldBoundsRotation = mRotation;
+        mWorldBoundsVersion = mShape->getVersion();
+        mWorldBoundsValid = true;
+
+        if (target != nullptr) {
+            auto nodes = mShape->getSphereTree().getNodes();
+            target->nodeBounds.resize(nodes.size());
+            for (size_t i = 0; i < nodes.size(); ++i) {
+                target->nodeBounds[i] = worldNodeBounds(nodes[i]);
+            }
+            target->shape = mShape.get();
+            target->pos = mPosition;
+            target->rotation = mRotation;
+            target->version = mShape->getVersion();
+        }
+    }
+
+    // Keeps a world space copy of the shape spheres, SIMD arrays and sphere tree bounds, as the narrowphase
+    // reads them. The world holds them for the bodies in a pair and releases them once a body is in none,
+    // so only the bodies touching something pay for a copy of their shape.
+    void holdWorldSpheres() {
+        if (mWorldSpheres == nullptr) {
+            mWorldSpheres = std::make_shared<WorldSpheres>();
+        }
+        updateWorldSpheres();
+    }
+
+    void releaseWorldSpheres() {
+        mWorldSpheres.reset();
+    }
+
+    bool holdsWorldSpheres() const {
+        return mWorldSpheres != nullptr;
+    }
+
+    // Uses the world spheres of other, which must have the same shape at the same place, like the replicas
+    // of a static body in several worlds. The copy is made again on its own once either of them moves.
+    void shareWorldSpheres(Body &other) {
+        other.holdWorldSpheres();
+        mWorldSpheres = other.mWorldSpheres;
+        updateWorldSpheres();
+    }
+
+    // The getters of the world spheres hold them, see holdWorldSpheres
+    const std::vector<SphereU> &getWorldSpheres() {
+        holdWorldSpheres();
+        return mWorldSpheres->spheres;
+    }
+
+    const AABB<Unit> &getWorldAABB() {
+        updateWorldSpheres();
+        return mWorldAABB;
+    }
+
+    // Same spheres as getWorldSpheres, one array per component for the SIMD kernels
+    const SphereArrays &getWorldSphereArrays() {
+        holdWorldSpheres();
+        return mWorldSpheres->arrays;
+    }
+
+    // World space bounds of every node of the shape sphere tree, in the same order as the nodes
+    const std::vector<SphereU> &getWorldNodeBounds() {
+        holdWorldSpheres();
+        return mWorldSpheres->nodeBounds;
+    }
+
+    const SphereU &getWorldBoundingSphere() {
+        updateWorldSpheres();
+        return mWorldBoundingSphere;
+    }
+
+    // Lowers t to the closest sphere hit closer than t and returns true, sphere receives the index of
+    // that sphere in the shape, or of the triangle for a mesh. With anyHit the first hit closer than t
+    // ends the search.
+    bool raycast(Vec3U pos, Vec3U dir, Unit &t, int32_t *sphere = nullptr, bool anyHit = false) {
+        Unit boundT;
+        if (!getWorldBoundingSphere().raycast(pos, dir, boundT)) {
+            return false;
+        }
+
+        auto mesh = mShape->asMesh();
+        if (mesh != nullptr) {
+            double localPos[3], localDir[3];
+            mRotationMatrix.applyInverse(pos - mPosition, localPos);
+            mRotationMatrix.applyInverse(dir, localDir);
+            return mesh->getTriangleTree().raycast(mesh->getTriangles(), localPos, localDir, t, sphere, anyHit);
+        }
+
+        auto nodes = mShape->getSphereTree().getNodes();
+        if (nodes.empty()) {
+            return false;
+        }
+
+        // a body holding no world spheres transforms the nodes and spheres the ray reaches
+        auto held = mWorldSpheres.get();
+        auto localSpheres = mShape->getSpheres();
         bool found = false;
-        for (auto sphere: mShape->getSpheres()) {
-            sphere.rotateBy(getRotation().to<Unit>());
-            sphere.moveBy(getPos());
-            Unit current;
-            if (sphere.raycast(pos, dir, current)) {
-                if (current < t) {
+        int32_t stack[SphereTree::MaxDepth * 2 + 2];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+        while (stackSize > 0) {
+            auto nodeIndex = stack[--stackSize];
+            auto &node = nodes[nodeIndex];
+            auto bounds = held != nullptr ? held->nodeBounds[nodeIndex] : worldNodeBounds(node);
+            COWPHYS_PROFILE_COUNT(nodeVisits, 1);
+            Unit nodeT;
+            if (!bounds.raycast(pos, dir, nodeT) || (nodeT > t && !bounds.contains(pos))) {
+                continue;
+            }
+
+            if (!node.isLeaf()) {
+                stack[stackSize++] = node.right;
+                stack[stackSize++] = node.left;
+                continue;
+            }
+
+            for (int32_t i = node.start; i < node.start + node.count; ++i) {
+                Unit current;
+                auto world = held != nullptr ? held->spheres[i] : worldSphere(localSpheres[i]);
+                if (world.raycast(pos, dir, current) && current < t) {
                     t = current;
+                    found = true;
+                    if (sphere != nullptr) {
+                        *sphere = i;
+                    }
+                    if (anyHit) {
+                        return true;
+                    }
                 }
-                found = true;
             }
         }
 
@@ -92,6 +304,62 @@ public:
 
     }
 
+    // Sleeping bodies are neither integrated nor tested against each other or static bodies,
+    // they only collide with awake bodies, which wakes them up
+    bool isSleeping() const {
+        return mSleeping;
+    }
+
+    void wake() {
+        mSleeping = false;
+        mRestTicks = 0;
+    }
+
+    // Creation order of the body in its world, used wherever bodies need an order that does not
+    // depend on their addresses
+    uint64_t getId() const {
+        return mId;
+    }
+
+    BodyHandle getHandle() const {
+        return mHandle;
+    }
+
+    // Position of the body in the body list of its world
+    uint32_t getIndex() const {
+        return mIndex;
+    }
+
+    // Categories are bits the body belongs to, the mask the categories it collides with. Two bodies
+    // only collide when each mask takes in a category of the other, rejected pairs never reach the
+    // narrowphase. Raycasts test their own mask against the category.
+    void setCollisionFilter(uint32_t category, uint32_t mask) {
+        mCategory = category;
+        mCollisionMask = mask;
+    }
+
+    uint32_t getCategory() const {
+        return mCategory;
+    }
+
+    uint32_t getCollisionMask() const {
+        return mCollisionMask;
+    }
+
+    // Bodies sharing an ignore group other than 0 never collide, like a projectile and its owner
+    void setIgnoreGroup(uint32_t group) {
+        mIgnoreGroup = group;
+    }
+
+    uint32_t getIgnoreGroup() const {
+        return mIgnoreGroup;
+    }
+
+    bool canCollideWith(const Body &other) const {
+        return (mCategory & other.mCollisionMask) != 0 && (other.mCategory & mCollisionMask) != 0 &&
+               (mIgnoreGroup == 0 || mIgnoreGroup != other.mIgnoreGroup);
+    }
+
     bool hasCollisionWith(Body *body) {
         for (auto &collision: mCollisions) {
             if (collision.getCollided() == body) {
@@ -112,16 +380,70 @@ public:
         return mCollisions;
     }
 
+protected:
+
+    // Moves the body without waking it, for the simulation itself
+    void movePos(const Vec3U &pos) {
+        mPosition = pos;
+    }
+
 private:
 
+    friend class PhysWorld;
+
+    // World space copy of the spheres of a shape, along with the transform it was made for
+    struct WorldSpheres {
+        std::vector<SphereU> spheres;
+        SphereArrays arrays;
+        std::vector<SphereU> nodeBounds;
+        const Shape *shape = nullptr;
+        Vec3U pos;
+        Vec3Small rotation;
+        uint32_t version = 0;
+    };
+
+    bool isCurrent(const WorldSpheres &worldSpheres) const {
+        return worldSpheres.shape == mShape.get() && worldSpheres.pos == mPosition &&
+               worldSpheres.rotation == mRotation && worldSpheres.version == mShape->getVersion();
+    }
+
+    SphereU worldSphere(SphereU sphere) const {
+        sphere.rotateBy(mRotationMatrix);
+        sphere.moveBy(mPosition);
+        return sphere;
+    }
+
+    SphereU worldNodeBounds(const SphereTreeNode &node) const {
+        return worldSphere(node.bounds);
+    }
+
+    bool mSleeping = false;
+    uint32_t mRestTicks = 0;
+
+    uint64_t mId = 0;
+    uint32_t mIndex = 0;
+    uint32_t mCategory = 1;
+    uint32_t mCollisionMask = AllCategories;
+    uint32_t mIgnoreGroup = 0;
+    BodyHandle mHandle;
     Vec3U mPosition;
     Vec3Small mRotation;
-    Shape *mShape;
+    RotationMatrix mRotationMatrix;
+    std::shared_ptr<const Shape> mShape;
     SmallUnit mMass;
     SmallUnit mRestitution;
     SmallUnit mFriction;
     std::vector<Collision> mCollisions;
     void *mUserData;
+
+    // nullptr while the body holds no world spheres
+    std::shared_ptr<WorldSpheres> mWorldSpheres;
+    AABB<Unit> mWorldAABB;
+    SphereU mWorldBoundingSphere;
+    uint32_t mWorldBoundsVersion;
+    Vec3U mWorldBoundsPos;
+    Vec3Small mWorldBoundsRotation;
+    bool mWorldBoundsValid;
 };
 
 } // namespace cp
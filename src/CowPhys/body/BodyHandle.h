@@ -0,0 +1,30 @@
+#ifndef COWPHYS_BODYHANDLE_H
+#define COWPHYS_BODYHANDLE_H
+
+#include <cstdint>
+
+namespace cp {
+
+// Refers to a body slot of a world. Destroying the body bumps the generation of its slot,
+// so handles kept around after that are detected as stale instead of reaching another body.
+struct BodyHandle {
+    uint32_t index = 0;
+    uint32_t generation = 0;
+
+    // Only tells whether the handle was ever assigned, PhysWorld::getBody checks it is still alive
+    bool isSet() const {
+        return generation != 0;
+    }
+
+    bool operator==(const BodyHandle &rhs) const {
+        return index == rhs.index && generation == rhs.generation;
+    }
+
+    bool operator!=(const BodyHandle &rhs) const {
+        return !(*this == rhs);
+    }
+};
+
+}
+
+#endif //COWPHYS_BODYHANDLE_H
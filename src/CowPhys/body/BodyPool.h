@@ -0,0 +1,60 @@
+#ifndef COWPHYS_BODYPOOL_H
+#define COWPHYS_BODYPOOL_H
+
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace cp {
+
+// Slab allocator for bodies, memory is grabbed ChunkSize bodies at a time and freed slots are
+// reused before growing. Bodies never move once created.
+template<class T, size_t ChunkSize = 256>
+class BodyPool {
+
+public:
+
+    BodyPool() = default;
+
+    BodyPool(const BodyPool &) = delete;
+
+    BodyPool &operator=(const BodyPool &) = delete;
+
+    template<class... Args>
+    T *create(Args &&... args) {
+        if (mFree.empty()) {
+            grow();
+        }
+
+        void *slot = mFree.back();
+        mFree.pop_back();
+        return new(slot) T(std::forward<Args>(args)...);
+    }
+
+    void destroy(T *body) {
+        body->~T();
+        mFree.push_back(body);
+    }
+
+private:
+
+    typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Storage;
+
+    void grow() {
+        mChunks.emplace_back(new Storage[ChunkSize]);
+        auto chunk = mChunks.back().get();
+        // pushed backwards so bodies are handed out in address order
+        for (size_t i = ChunkSize; i > 0; --i) {
+            mFree.push_back(&chunk[i - 1]);
+        }
+    }
+
+    std::vector<std::unique_ptr<Storage[]>> mChunks;
+    std::vector<void *> mFree;
+
+};
+
+}
+
+#endif //COWPHYS_BODYPOOL_H
@@ -7,32 +7,30 @@ namespace cp {
 
 class DynBody : public Body {
 
-    static int constexpr VelocityToPosition = 8;
-
 public:
 
-    explicit DynBody(Shape *shape) : Body(shape), mAllowRotation(true) {
+    // A body moves by its velocity divided by this every tick
+    static int constexpr VelocityToPosition = 8;
+
+    explicit DynBody(std::shared_ptr<const Shape> shape) : Body(std::move(shape)), mDrag(1), mAllowRotation(true),
+                                                           mContinuous(false) {
     }
 
     void update() override {
         Body::update();
-        setPos(getPos() + mVelocity / VelocityToPosition);
+        movePos(getPos() + mVelocity / VelocityToPosition);
         setRotation(getRotation() + mAngularVelocity.to<SmallUnit>() / VelocityToPosition);
-        applyFriction();
+        applyDrag();
     }
 
     void applyForce(const Vec3U &force) {
-        Vec3U acceleration = force / getMass();
-        mVelocity = mVelocity + acceleration;
+        wake();
+        accelerate(force);
     }
 
     void applyForceAt(const Vec3U &force, const Vec3U &at) {
-        applyForce(force);
-        if (mAllowRotation) {
-            auto relative = (at - getPos()).normalize();
-            auto torque = relative.cross(force);
-            mAngularVelocity = mAngularVelocity + torque;
-        }
+        wake();
+        accelerateAt(force, at);
     }
 
     Vec3U getVelocity() const {
@@ -40,13 +38,19 @@ public:
     }
 
     void setVelocity(const Vec3U &velocity) {
+        wake();
         mVelocity = velocity;
     }
 
     void setAngularVelocity(const Vec3U &angular) {
+        wake();
         mAngularVelocity = angular;
     }
 
+    bool isResting() const {
+        return mVelocity.isZero() && mAngularVelocity.isZero();
+    }
+
     Vec3U getAngularVelocity() const {
         return mAngularVelocity;
     }
@@ -59,15 +63,50 @@ public:
         return mAllowRotation;
     }
 
+    // Velocity lost along every axis on every tick, whether the body touches anything or not
+    void setDrag(Unit drag) {
+        mDrag = drag;
+    }
+
+    Unit getDrag() const {
+        return mDrag;
+    }
+
+    // Sweeps the body over each step and stops it at the first static body in its way, so fast bodies
+    // cannot pass through thin walls. Only the translation of the step is swept, not its rotation.
+    void setContinuousCollision(bool continuous) {
+        mContinuous = continuous;
+    }
+
+    bool hasContinuousCollision() const {
+        return mContinuous;
+    }
+
 private:
 
-    void applyFriction() {
-        auto friction = getFriction();
+    friend class PhysWorld;
+
+    // Forces applied by the simulation itself, they do not reset the sleep counter
+    void accelerate(const Vec3U &force) {
+        Vec3U acceleration = force / getMass();
+        mVelocity = mVelocity + acceleration;
+    }
+
+    void accelerateAt(const Vec3U &force, const Vec3U &at) {
+        accelerate(force);
+        if (mAllowRotation) {
+            auto relative = (at - getPos()).normalize();
+            auto torque = relative.cross(force);
+            mAngularVelocity = mAngularVelocity + torque;
+        }
+    }
+
+    void applyDrag() {
         for (int i = 0; i < 3; ++i) {
-            if (mVelocity[i] >= friction) {
-                mVelocity[i] = mVelocity[i] - friction;
-            } else if (mVelocity[i] <= -friction) {
-                mVelocity[i] = mVelocity[i] + friction;
+            if (mVelocity[i] >= mDrag) {
+                mVelocity[i] = mVelocity[i] - mDrag;
+            } else if (mVelocity[i] <= -mDrag) {
+                mVelocity[i] = mVelocity[i] + mDrag;
             } else {
                 mVelocity[i] = 0;
             }
@@ -76,7 +115,9 @@ private:
 
     Vec3U mVelocity;
     Vec3U mAngularVelocity;
+    Unit mDrag;
     bool mAllowRotation;
+    bool mContinuous;
 
 };
 
@@ -8,7 +8,7 @@ class StaticBody : public Body {
 
 public:
 
-    explicit StaticBody(Shape *shape) : Body(shape) {
+    explicit StaticBody(std::shared_ptr<const Shape> shape) : Body(std::move(shape)) {
 
     }
 
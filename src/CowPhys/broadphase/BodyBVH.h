@@ -0,0 +1,275 @@
+#ifndef COWPHYS_BODYBVH_H
+#define COWPHYS_BODYBVH_H
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "BroadPhase.h"
+#include "RayPacket.h"
+#include "CowPhys/profile/Profiler.h"
+
+namespace cp {
+
+// Bounding volume hierarchy over the world AABB of a set of bodies. The tree is static, it has
+// to be rebuilt once the bodies moved.
+template<class BodyType>
+class BodyBVH {
+
+public:
+
+    static constexpr int MaxLeafSize = 2;
+
+    void build(const std::vector<BodyType *> &bodies) {
+        mNodes.clear();
+        mItems.clear();
+        mBodies.clear();
+
+        if (bodies.empty()) {
+            return;
+        }
+
+        for (size_t i = 0; i < bodies.size(); ++i) {
+            auto &aabb = bodies[i]->getWorldAABB();
+            mItems.push_back({aabb.getMin(), aabb.getMax(), aabb.pos, bodies[i], i});
+        }
+
+        mNodes.reserve(bodies.size() * 2);
+        buildNode(0, mItems.size(), 0);
+
+        for (auto &item: mItems) {
+            mBodies.push_back(item.body);
+        }
+    }
+
+    template<class F>
+    void query(const Vec3U &min, const Vec3U &max, F &&callback) const {
+        if (mNodes.empty()) {
+            return;
+        }
+
+        int32_t stack[64];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+        while (stackSize > 0) {
+            auto &node = mNodes[stack[--stackSize]];
+            if (!overlaps(node, min, max)) {
+                continue;
+            }
+
+            if (node.count > 0) {
+                for (int32_t i = node.start; i < node.start + node.count; ++i) {
+                    callback(mBodies[i]);
+                }
+            } else {
+                stack[stackSize++] = node.right;
+                stack[stackSize++] = node.left;
+            }
+        }
+    }
+
+    // Visits the bodies whose box is crossed by the ray, nearest boxes first. The callback receives
+    // the best distance found so far and may lower it to prune the rest of the traversal.
+    template<class F>
+    void raycast(const Vec3U &pos, const Vec3U &dir, Unit &t, F &&callback) const {
+        if (mNodes.empty()) {
+            return;
+        }
+
+        int32_t stack[64];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+        while (stackSize > 0) {
+            auto &node = mNodes[stack[--stackSize]];
+            COWPHYS_PROFILE_COUNT(nodeVisits, 1);
+            double enter;
+            if (!rayEnters(node, pos, dir, t, enter)) {
+                continue;
+            }
+
+            if (node.count > 0) {
+                for (int32_t i = node.start; i < node.start + node.count; ++i) {
+                    callback(mBodies[i], t);
+                }
+            } else {
+                double enterLeft, enterRight;
+                bool hitLeft = rayEnters(mNodes[node.left], pos, dir, t, enterLeft);
+                bool hitRight = rayEnters(mNodes[node.right], pos, dir, t, enterRight);
+                if (hitLeft && hitRight) {
+                    bool leftFirst = enterLeft <= enterRight;
+                    stack[stackSize++] = leftFirst ? node.right : node.left;
+                    stack[stackSize++] = leftFirst ? node.left : node.right;
+                } else if (hitLeft) {
+                    stack[stackSize++] = node.left;
+                } else if (hitRight) {
+                    stack[stackSize++] = node.right;
+                }
+            }
+        }
+    }
+
+    // Walks the tree once for a whole packet, each node only tests the rays that entered its parent.
+    // The callback receives every (body, ray) whose leaf the ray reaches, rays is scratch space.
+    template<class F>
+    void raycastPacket(const RayPacket &packet, std::vector<uint32_t> &rays, F &&callback) const {
+        if (mNodes.empty() || packet.size() == 0) {
+            return;
+        }
+
+        rays.clear();
+        for (uint32_t i = 0; i < packet.size(); ++i) {
+            rays.push_back(i);
+        }
+        raycastPacketNode(0, packet, rays, 0, rays.size(), callback);
+    }
+
+    bool empty() const {
+        return mNodes.empty();
+    }
+
+private:
+
+    struct Node {
+        Vec3U min;
+        Vec3U max;
+        int32_t left;
+        int32_t right;
+        int32_t start;
+        int32_t count;
+    };
+
+    struct Item {
+        Vec3U min;
+        Vec3U max;
+        Vec3U center;
+        BodyType *body;
+        size_t index;
+    };
+
+    int32_t buildNode(size_t start, size_t end, int depth) {
+        auto index = static_cast<int32_t>(mNodes.size());
+        mNodes.emplace_back();
+
+        Vec3U min(std::numeric_limits<Unit>::max());
+        Vec3U max(std::numeric_limits<Unit>::min());
+        Vec3U centerMin(std::numeric_limits<Unit>::max());
+        Vec3U centerMax(std::numeric_limits<Unit>::min());
+        for (size_t i = start; i < end; ++i) {
+            min = min.min(mItems[i].min);
+            max = max.max(mItems[i].max);
+            centerMin = centerMin.min(mItems[i].center);
+            centerMax = centerMax.max(mItems[i].center);
+        }
+
+        Node node{};
+        node.min = min;
+        node.max = max;
+
+        // the traversal stacks are fixed size, past that depth the remaining bodies share a leaf
+        if (end - start <= MaxLeafSize || depth >= 30) {
+            node.start = static_cast<int32_t>(start);
+            node.count = static_cast<int32_t>(end - start);
+            mNodes[index] = node;
+            return index;
+        }
+
+        auto extent = centerMax - centerMin;
+        int axis = 0;
+        if (extent.y > extent[axis]) {
+            axis = 1;
+        }
+        if (extent.z > extent[axis]) {
+            axis = 2;
+        }
+
+        auto middle = start + (end - start) / 2;
+        std::nth_element(mItems.begin() + start, mItems.begin() + middle, mItems.begin() + end,
+                         [axis](Item &left, Item &right) {
+                             if (left.center[axis] != right.center[axis]) {
+                                 return left.center[axis] < right.center[axis];
+                             }
+                             return left.index < right.index;
+                         });
+
+        node.left = buildNode(start, middle, depth + 1);
+        node.right = buildNode(middle, end, depth + 1);
+        mNodes[index] = node;
+        return index;
+    }
+
+    template<class F>
+    void raycastPacketNode(int32_t index, const RayPacket &packet, std::vector<uint32_t> &rays,
+                           size_t begin, size_t end, F &callback) const {
+        auto &node = mNodes[index];
+        COWPHYS_PROFILE_COUNT(nodeVisits, 1);
+        size_t activeBegin = rays.size();
+        packet.filter(node.min, node.max, rays, begin, end, rays);
+        size_t activeEnd = rays.size();
+
+        if (activeBegin != activeEnd) {
+            if (node.count > 0) {
+                for (int32_t i = node.start; i < node.start + node.count; ++i) {
+                    for (size_t ray = activeBegin; ray < activeEnd; ++ray) {
+                        callback(mBodies[i], rays[ray]);
+                    }
+                }
+            } else {
+                raycastPacketNode(node.left, packet, rays, activeBegin, activeEnd, callback);
+                raycastPacketNode(node.right, packet, rays, activeBegin, activeEnd, callback);
+            }
+        }
+
+        rays.resize(activeBegin);
+    }
+
+    static bool overlaps(const Node &node, const Vec3U &min, const Vec3U &max) {
+        return node.min.x <= max.x && min.x <= node.max.x &&
+               node.min.y <= max.y && min.y <= node.max.y &&
+               node.min.z <= max.z && min.z <= node.max.z;
+    }
+
+    static bool rayEnters(const Node &node, const Vec3U &pos, const Vec3U &dir, Unit t, double &enter) {
+        double tMin = 0;
+        double tMax = static_cast<double>(t) + 1;
+        const Unit origin[3] = {pos.x, pos.y, pos.z};
+        const Unit direction[3] = {dir.x, dir.y, dir.z};
+        const Unit min[3] = {node.min.x, node.min.y, node.min.z};
+        const Unit max[3] = {node.max.x, node.max.y, node.max.z};
+
+        for (int i = 0; i < 3; ++i) {
+            if (direction[i] == 0) {
+                if (origin[i] < min[i] || origin[i] > max[i]) {
+                    return false;
+                }
+                continue;
+            }
+
+            double inv = 1.0 / static_cast<double>(direction[i]);
+            double near = static_cast<double>(min[i] - origin[i]) * inv;
+            double far = static_cast<double>(max[i] - origin[i]) * inv;
+            if (near > far) {
+                std::swap(near, far);
+            }
+            tMin = std::max(tMin, near);
+            tMax = std::min(tMax, far);
+            if (tMin > tMax) {
+                return false;
+            }
+        }
+
+        enter = tMin;
+        return true;
+    }
+
+    std::vector<Node> mNodes;
+    std::vector<Item> mItems;
+    std::vector<BodyType *> mBodies;
+
+};
+
+typedef BodyBVH<StaticBody> StaticBVH;
+typedef BodyBVH<DynBody> DynBVH;
+
+}
+
+#endif //COWPHYS_BODYBVH_H
@@ -0,0 +1,33 @@
+#ifndef COWPHYS_BROADPHASE_H
+#define COWPHYS_BROADPHASE_H
+
+#include <utility>
+#include <vector>
+#include "CowPhys/body/DynBody.h"
+#include "CowPhys/body/StaticBody.h"
+
+namespace cp {
+
+enum class BroadPhaseType {
+    BruteForce,
+    SweepAndPrune,
+    // keeps the dynamic bodies and their pairs from one step to the next, suited to worlds where
+    // most bodies barely move
+    DynamicTree
+};
+
+typedef std::pair<DynBody *, DynBody *> DynPair;
+typedef std::pair<DynBody *, StaticBody *> StaticPair;
+
+// Order every broad phase hands its dynamic pairs to the solver in, the lower id comes first in a pair.
+// The solver depends on the contact order, so the broad phases only give the same step when they agree on it.
+inline bool pairIdLess(const DynPair &left, const DynPair &right) {
+    if (left.first->getId() != right.first->getId()) {
+        return left.first->getId() < right.first->getId();
+    }
+    return left.second->getId() < right.second->getId();
+}
+
+}
+
+#endif //COWPHYS_BROADPHASE_H
@@ -0,0 +1,371 @@
+#include "DynamicTree.h"
+#include <algorithm>
+
+namespace cp {
+
+void DynamicTree::findPairs(const std::vector<DynBody *> &dynBodies, std::vector<DynPair> &dynPairs) {
+    mMoved.clear();
+    for (auto body: dynBodies) {
+        auto proxy = findProxy(body);
+        if (proxy->leaf != Null) {
+            // sleeping bodies are checked too, the solver may have moved them on the step they fell asleep
+            auto &aabb = body->getWorldAABB();
+            auto &leaf = mNodes[proxy->leaf];
+            if (contains(leaf.min, leaf.max, aabb.getMin(), aabb.getMax())) {
+                continue;
+            }
+            removeLeaf(proxy->leaf);
+        } else {
+            proxy->body = body;
+            proxy->leaf = allocateNode();
+            mNodes[proxy->leaf].body = body;
+        }
+
+        auto &leaf = mNodes[proxy->leaf];
+        fatten(body, leaf.min, leaf.max);
+        insertLeaf(proxy->leaf);
+        proxy->moved = true;
+        mMoved.push_back(body);
+    }
+
+    // the pairs of a moved body are all found again by querying its new fat box
+    for (auto body: mMoved) {
+        removePairs(body->getHandle().index);
+    }
+
+    mNewPairs.clear();
+    for (auto body: mMoved) {
+        auto &leaf = mNodes[findProxy(body)->leaf];
+        mStack.clear();
+        mStack.push_back(mRoot);
+        while (!mStack.empty()) {
+            auto &node = mNodes[mStack.back()];
+            mStack.pop_back();
+            if (!overlaps(node.min, node.max, leaf.min, leaf.max)) {
+                continue;
+            }
+            if (!node.isLeaf()) {
+                mStack.push_back(node.left);
+                mStack.push_back(node.right);
+                continue;
+            }
+
+            auto other = node.body;
+            // two moved bodies find each other, the pair is only kept once
+            if (other == body || (findProxy(other)->moved && other->getId() < body->getId())) {
+                continue;
+            }
+            addPair(body, other);
+        }
+    }
+    for (auto body: mMoved) {
+        findProxy(body)->moved = false;
+    }
+    std::sort(mNewPairs.begin(), mNewPairs.end());
+
+    if (mNewPairs.empty() && mDeadPairs == 0) {
+        for (auto &ref: mOrder) {
+            emitPair(ref, dynPairs);
+        }
+        return;
+    }
+
+    // the new pairs are merged in and the dropped ones freed on the way through every pair
+    mMerged.clear();
+    size_t oldIndex = 0;
+    size_t newIndex = 0;
+    while (oldIndex < mOrder.size() || newIndex < mNewPairs.size()) {
+        if (newIndex == mNewPairs.size() || (oldIndex < mOrder.size() && mOrder[oldIndex] < mNewPairs[newIndex])) {
+            auto &ref = mOrder[oldIndex++];
+            if (mDeadPairs > 0 && !mPairs[ref.pair].alive) {
+                mFreePairs.push_back(ref.pair);
+                continue;
+            }
+            mMerged.push_back(ref);
+        } else {
+            mMerged.push_back(mNewPairs[newIndex++]);
+        }
+        emitPair(mMerged.back(), dynPairs);
+    }
+    mOrder.swap(mMerged);
+    mDeadPairs = 0;
+}
+
+void DynamicTree::remove(const DynBody *body) {
+    auto index = body->getHandle().index;
+    if (index >= mProxies.size() || mProxies[index].body != body || mProxies[index].leaf == Null) {
+        return;
+    }
+
+    auto &proxy = mProxies[index];
+    removeLeaf(proxy.leaf);
+    freeNode(proxy.leaf);
+    removePairs(index);
+    proxy.body = nullptr;
+    proxy.leaf = Null;
+    proxy.moved = false;
+}
+
+void DynamicTree::removePairs(uint32_t proxy) {
+    auto index = mProxies[proxy].firstPair;
+    while (index != NoPair) {
+        auto &pair = mPairs[index];
+        auto side = pair.sideOf(proxy);
+        auto next = pair.next[side];
+        // a pair already dead was dropped with the other body, which moved too
+        if (pair.alive) {
+            pair.alive = false;
+            ++mDeadPairs;
+            auto other = pair.proxies[1 - side];
+            // the list of a moved body is cleared as a whole
+            if (!mProxies[other].moved) {
+                unlink(other, index, 1 - side);
+            }
+        }
+        index = next;
+    }
+    mProxies[proxy].firstPair = NoPair;
+}
+
+void DynamicTree::addPair(DynBody *body, DynBody *other) {
+    uint32_t index;
+    if (mFreePairs.empty()) {
+        index = static_cast<uint32_t>(mPairs.size());
+        mPairs.emplace_back();
+    } else {
+        index = mFreePairs.back();
+        mFreePairs.pop_back();
+    }
+
+    if (other->getId() < body->getId()) {
+        std::swap(body, other);
+    }
+    auto &pair = mPairs[index];
+    pair.first = body;
+    pair.second = other;
+    pair.proxies[0] = body->getHandle().index;
+    pair.proxies[1] = other->getHandle().index;
+    pair.alive = true;
+    link(pair.proxies[0], index, 0);
+    link(pair.proxies[1], index, 1);
+    mNewPairs.push_back({body->getId(), other->getId(), body, other, index});
+}
+
+void DynamicTree::link(uint32_t proxy, uint32_t pair, int side) {
+    auto head = mProxies[proxy].firstPair;
+    mPairs[pair].previous[side] = NoPair;
+    mPairs[pair].next[side] = head;
+    if (head != NoPair) {
+        auto &headPair = mPairs[head];
+        headPair.previous[headPair.sideOf(proxy)] = pair;
+    }
+    mProxies[proxy].firstPair = pair;
+}
+
+void DynamicTree::unlink(uint32_t proxy, uint32_t pair, int side) {
+    auto previous = mPairs[pair].previous[side];
+    auto next = mPairs[pair].next[side];
+    if (previous == NoPair) {
+        mProxies[proxy].firstPair = next;
+    } else {
+        auto &previousPair = mPairs[previous];
+        previousPair.next[previousPair.sideOf(proxy)] = next;
+    }
+    if (next != NoPair) {
+        auto &nextPair = mPairs[next];
+        nextPair.previous[nextPair.sideOf(proxy)] = previous;
+    }
+}
+
+void DynamicTree::emitPair(const PairRef &ref, std::vector<DynPair> &dynPairs) {
+    // fat boxes overlap long before the bodies do, the tight boxes decide what reaches the narrowphase
+    if (!ref.first->canCollideWith(*ref.second)) {
+        return;
+    }
+    auto &first = ref.first->getWorldAABB();
+    auto &second = ref.second->getWorldAABB();
+    if (overlaps(first.getMin(), first.getMax(), second.getMin(), second.getMax())) {
+        dynPairs.emplace_back(ref.first, ref.second);
+    }
+}
+
+DynamicTree::Proxy *DynamicTree::findProxy(const DynBody *body) {
+    auto index = body->getHandle().index;
+    if (index >= mProxies.size()) {
+        mProxies.resize(index + 1);
+    }
+    return &mProxies[index];
+}
+
+void DynamicTree::fatten(DynBody *body, Vec3U &min, Vec3U &max) {
+    auto &aabb = body->getWorldAABB();
+    auto half = aabb.halfSize;
+    auto margin = std::max(std::max(std::max(half.x, half.y), half.z) / MarginDivisor, MinMargin);
+    min = aabb.getMin() - Vec3U(margin);
+    max = aabb.getMax() + Vec3U(margin);
+
+    auto motion = body->getVelocity() * PredictedTicks / DynBody::VelocityToPosition;
+    min = min.min(min + motion);
+    max = max.max(max + motion);
+}
+
+int32_t DynamicTree::allocateNode() {
+    int32_t index;
+    if (mFreeNode != Null) {
+        index = mFreeNode;
+        mFreeNode = mNodes[index].parent;
+    } else {
+        index = static_cast<int32_t>(mNodes.size());
+        mNodes.emplace_back();
+    }
+
+    auto &node = mNodes[index];
+    node.parent = Null;
+    node.left = Null;
+    node.right = Null;
+    node.height = 0;
+    node.body = nullptr;
+    return index;
+}
+
+void DynamicTree::freeNode(int32_t node) {
+    mNodes[node].parent = mFreeNode;
+    mNodes[node].height = -1;
+    mFreeNode = node;
+}
+
+void DynamicTree::insertLeaf(int32_t leaf) {
+    if (mRoot == Null) {
+        mRoot = leaf;
+        mNodes[leaf].parent = Null;
+        return;
+    }
+
+    // walk down to where the new leaf grows the tree the least
+    auto min = mNodes[leaf].min;
+    auto max = mNodes[leaf].max;
+    auto index = mRoot;
+    while (!mNodes[index].isLeaf()) {
+        auto &node = mNodes[index];
+        double combined = area(node.min.min(min), node.max.max(max));
+        // pairing the leaf with this node, or pushing it further down, which grows this node anyway
+        double cost = 2 * combined;
+        double inherited = 2 * (combined - area(node.min, node.max));
+        auto descendCost = [this, &min, &max, inherited](int32_t child) {
+            auto &childNode = mNodes[child];
+            double grown = area(childNode.min.min(min), childNode.max.max(max));
+            return childNode.isLeaf() ? grown + inherited : grown - area(childNode.min, childNode.max) + inherited;
+        };
+        double leftCost = descendCost(node.left);
+        double rightCost = descendCost(node.right);
+        if (cost < leftCost && cost < rightCost) {
+            break;
+        }
+        index = leftCost <= rightCost ? node.left : node.right;
+    }
+
+    auto sibling = index;
+    auto parent = allocateNode();
+    auto oldParent = mNodes[sibling].parent;
+    mNodes[parent].parent = oldParent;
+    mNodes[parent].left = sibling;
+    mNodes[parent].right = leaf;
+    if (oldParent == Null) {
+        mRoot = parent;
+    } else if (mNodes[oldParent].left == sibling) {
+        mNodes[oldParent].left = parent;
+    } else {
+        mNodes[oldParent].right = parent;
+    }
+    mNodes[sibling].parent = parent;
+    mNodes[leaf].parent = parent;
+
+    refit(parent);
+}
+
+void DynamicTree::removeLeaf(int32_t leaf) {
+    if (leaf == mRoot) {
+        mRoot = Null;
+        return;
+    }
+
+    auto parent = mNodes[leaf].parent;
+    auto grandParent = mNodes[parent].parent;
+    auto sibling = mNodes[parent].left == leaf ? mNodes[parent].right : mNodes[parent].left;
+    freeNode(parent);
+
+    mNodes[sibling].parent = grandParent;
+    if (grandParent == Null) {
+        mRoot = sibling;
+        return;
+    }
+    if (mNodes[grandParent].left == parent) {
+        mNodes[grandParent].left = sibling;
+    } else {
+        mNodes[grandParent].right = sibling;
+    }
+    refit(grandParent);
+}
+
+void DynamicTree::fit(int32_t node) {
+    auto &fitted = mNodes[node];
+    auto &left = mNodes[fitted.left];
+    auto &right = mNodes[fitted.right];
+    fitted.min = left.min.min(right.min);
+    fitted.max = left.max.max(right.max);
+    fitted.height = 1 + std::max(left.height, right.height);
+}
+
+void DynamicTree::refit(int32_t node) {
+    while (node != Null) {
+        node = balance(node);
+        fit(node);
+        node = mNodes[node].parent;
+    }
+}
+
+int32_t DynamicTree::balance(int32_t node) {
+    auto &top = mNodes[node];
+    if (top.isLeaf() || top.height < 2) {
+        return node;
+    }
+
+    auto left = top.left;
+    auto right = top.right;
+    auto difference = mNodes[right].height - mNodes[left].height;
+    if (difference >= -1 && difference <= 1) {
+        return node;
+    }
+
+    // the taller child takes the place of node, node keeps the shorter grandchild
+    bool rightUp = difference > 1;
+    auto lifted = rightUp ? right : left;
+    auto &up = mNodes[lifted];
+    auto tall = mNodes[up.left].height > mNodes[up.right].height ? up.left : up.right;
+    auto shortChild = tall == up.left ? up.right : up.left;
+
+    up.parent = top.parent;
+    top.parent = lifted;
+    if (up.parent == Null) {
+        mRoot = lifted;
+    } else if (mNodes[up.parent].left == node) {
+        mNodes[up.parent].left = lifted;
+    } else {
+        mNodes[up.parent].right = lifted;
+    }
+
+    up.left = node;
+    up.right = tall;
+    if (rightUp) {
+        top.right = shortChild;
+    } else {
+        top.left = shortChild;
+    }
+    mNodes[shortChild].parent = node;
+
+    fit(node);
+    fit(lifted);
+    return lifted;
+}
+
+}
@@ -0,0 +1,170 @@
+#ifndef COWPHYS_DYNAMICTREE_H
+#define COWPHYS_DYNAMICTREE_H
+
+#include <cstdint>
+#include <vector>
+#include "BroadPhase.h"
+
+namespace cp {
+
+// Bounding volume hierarchy over the dynamic bodies that is kept from one step to the next. Every
+// body is stored with a fat box, larger than its own and stretched along its velocity, and is only
+// reinserted once its box leaves the fat one. The pairs whose fat boxes overlap are kept as well and
+// listed by body, so a step only drops and queries again the pairs of the bodies that moved that far.
+class DynamicTree {
+
+public:
+
+    // Fat boxes are grown by a part of the body size on every side, at least MinMargin
+    static constexpr Unit MarginDivisor = 8;
+    static constexpr Unit MinMargin = 4;
+    // and stretched by the distance the body covers in that many ticks
+    static constexpr Unit PredictedTicks = 4;
+
+    // Brings the tree up to date with the bodies and appends the pairs whose boxes overlap and which
+    // may collide, ordered by body id
+    void findPairs(const std::vector<DynBody *> &dynBodies, std::vector<DynPair> &dynPairs);
+
+    // Drops the body along with its pairs, must be called before the body is destroyed
+    void remove(const DynBody *body);
+
+    // Bodies that had to be reinserted during the last findPairs
+    size_t getMovedCount() const {
+        return mMoved.size();
+    }
+
+    // Number of edges from the root to the deepest leaf
+    int32_t getHeight() const {
+        return mRoot == Null ? 0 : mNodes[mRoot].height;
+    }
+
+private:
+
+    static constexpr int32_t Null = -1;
+
+    struct Node {
+        Vec3U min;
+        Vec3U max;
+        // next free node while the node is unused
+        int32_t parent;
+        int32_t left;
+        int32_t right;
+        // leaves are at height 0, unused nodes at -1
+        int32_t height;
+        DynBody *body;
+
+        bool isLeaf() const {
+            return left == Null;
+        }
+    };
+
+    static constexpr uint32_t NoPair = 0xffffffff;
+
+    // Leaf of a body, indexed by the slot of its handle
+    struct Proxy {
+        const DynBody *body = nullptr;
+        int32_t leaf = Null;
+        bool moved = false;
+        // first of the pairs of the body, linked through mPairs
+        uint32_t firstPair = NoPair;
+    };
+
+    // Every pair is in the lists of its two bodies, side 0 links it for first and side 1 for second
+    struct Pair {
+        DynBody *first;
+        DynBody *second;
+        uint32_t proxies[2];
+        uint32_t next[2];
+        uint32_t previous[2];
+        // dropped pairs stay in mOrder until the next findPairs, which frees them
+        bool alive;
+
+        int sideOf(uint32_t proxy) const {
+            return proxies[0] == proxy ? 0 : 1;
+        }
+    };
+
+    // A pair in mPairs along with the ids ordering it and its bodies, so walking every pair stays in mOrder
+    struct PairRef {
+        uint64_t firstId;
+        uint64_t secondId;
+        DynBody *first;
+        DynBody *second;
+        uint32_t pair;
+
+        bool operator<(const PairRef &other) const {
+            return firstId != other.firstId ? firstId < other.firstId : secondId < other.secondId;
+        }
+    };
+
+    Proxy *findProxy(const DynBody *body);
+
+    // Drops every pair of the proxy, taking them off the lists of the other bodies
+    void removePairs(uint32_t proxy);
+
+    void addPair(DynBody *body, DynBody *other);
+
+    void link(uint32_t proxy, uint32_t pair, int side);
+
+    void unlink(uint32_t proxy, uint32_t pair, int side);
+
+    // Appends the pair to dynPairs when the bodies overlap and may collide
+    static void emitPair(const PairRef &ref, std::vector<DynPair> &dynPairs);
+
+    void fatten(DynBody *body, Vec3U &min, Vec3U &max);
+
+    int32_t allocateNode();
+
+    void freeNode(int32_t node);
+
+    void insertLeaf(int32_t leaf);
+
+    void removeLeaf(int32_t leaf);
+
+    // Sets the box and height of node from its two children
+    void fit(int32_t node);
+
+    // Refits the boxes and heights from node up to the root, rotating unbalanced nodes on the way
+    void refit(int32_t node);
+
+    // AVL rotation lifting the taller child of node above it, returns the node now in its place
+    int32_t balance(int32_t node);
+
+    static bool overlaps(const Vec3U &minA, const Vec3U &maxA, const Vec3U &minB, const Vec3U &maxB) {
+        return minA.x <= maxB.x && minB.x <= maxA.x && minA.y <= maxB.y && minB.y <= maxA.y &&
+               minA.z <= maxB.z && minB.z <= maxA.z;
+    }
+
+    static bool contains(const Vec3U &outerMin, const Vec3U &outerMax, const Vec3U &min, const Vec3U &max) {
+        return outerMin.x <= min.x && outerMin.y <= min.y && outerMin.z <= min.z &&
+               max.x <= outerMax.x && max.y <= outerMax.y && max.z <= outerMax.z;
+    }
+
+    // Half the surface of the box, what the insertion tries to keep small
+    static double area(const Vec3U &min, const Vec3U &max) {
+        auto x = static_cast<double>(max.x - min.x);
+        auto y = static_cast<double>(max.y - min.y);
+        auto z = static_cast<double>(max.z - min.z);
+        return x * y + y * z + z * x;
+    }
+
+    std::vector<Node> mNodes;
+    int32_t mRoot = Null;
+    int32_t mFreeNode = Null;
+    std::vector<Proxy> mProxies;
+    std::vector<Pair> mPairs;
+    std::vector<uint32_t> mFreePairs;
+    // pairs dropped since the last findPairs
+    size_t mDeadPairs = 0;
+    // every pair, ordered by body ids
+    std::vector<PairRef> mOrder;
+    std::vector<PairRef> mNewPairs;
+    std::vector<PairRef> mMerged;
+    std::vector<DynBody *> mMoved;
+    std::vector<int32_t> mStack;
+
+};
+
+}
+
+#endif //COWPHYS_DYNAMICTREE_H
@@ -0,0 +1,100 @@
+#ifndef COWPHYS_RAYPACKET_H
+#define COWPHYS_RAYPACKET_H
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "CowPhys/math/Vec3.h"
+
+namespace cp {
+
+// A batch of rays stored one array per component, so a box can be tested against the whole
+// packet in one loop the compiler can vectorize.
+class RayPacket {
+
+public:
+
+    void clear() {
+        mOriginX.clear();
+        mOriginY.clear();
+        mOriginZ.clear();
+        mInverseX.clear();
+        mInverseY.clear();
+        mInverseZ.clear();
+        mMaxT.clear();
+    }
+
+    void add(const Vec3U &pos, const Vec3U &dir) {
+        mOriginX.push_back(static_cast<double>(pos.x));
+        mOriginY.push_back(static_cast<double>(pos.y));
+        mOriginZ.push_back(static_cast<double>(pos.z));
+        mInverseX.push_back(inverse(dir.x));
+        mInverseY.push_back(inverse(dir.y));
+        mInverseZ.push_back(inverse(dir.z));
+        mMaxT.push_back(std::numeric_limits<double>::max());
+    }
+
+    size_t size() const {
+        return mOriginX.size();
+    }
+
+    // Rays are only tested up to their max t, a negative value retires the ray
+    void setMaxT(uint32_t ray, double t) {
+        mMaxT[ray] = t;
+    }
+
+    double getMaxT(uint32_t ray) const {
+        return mMaxT[ray];
+    }
+
+    // Appends to out every ray of rays[begin, end) entering the box before its max t
+    void filter(const Vec3U &min, const Vec3U &max, const std::vector<uint32_t> &rays,
+                size_t begin, size_t end, std::vector<uint32_t> &out) const {
+        double minX = static_cast<double>(min.x), maxX = static_cast<double>(max.x);
+        double minY = static_cast<double>(min.y), maxY = static_cast<double>(max.y);
+        double minZ = static_cast<double>(min.z), maxZ = static_cast<double>(max.z);
+        for (size_t i = begin; i < end; ++i) {
+            auto ray = rays[i];
+            if (mMaxT[ray] < 0) {
+                continue;
+            }
+            double nearX = (minX - mOriginX[ray]) * mInverseX[ray];
+            double farX = (maxX - mOriginX[ray]) * mInverseX[ray];
+            double nearY = (minY - mOriginY[ray]) * mInverseY[ray];
+            double farY = (maxY - mOriginY[ray]) * mInverseY[ray];
+            double nearZ = (minZ - mOriginZ[ray]) * mInverseZ[ray];
+            double farZ = (maxZ - mOriginZ[ray]) * mInverseZ[ray];
+            double enter = std::max(std::max(std::min(nearX, farX), std::min(nearY, farY)),
+                                    std::max(std::min(nearZ, farZ), 0.0));
+            double exit = std::min(std::min(std::max(nearX, farX), std::max(nearY, farY)),
+                                   std::min(std::max(nearZ, farZ), mMaxT[ray] + 1));
+            if (enter <= exit) {
+                out.push_back(ray);
+            }
+        }
+    }
+
+private:
+
+    // Axis aligned rays get a huge finite inverse instead of an infinite one, so a box face lying
+    // exactly on the origin gives 0 rather than NaN
+    static double inverse(Unit v) {
+        if (v == 0) {
+            return 1e300;
+        }
+        return 1.0 / static_cast<double>(v);
+    }
+
+    std::vector<double> mOriginX;
+    std::vector<double> mOriginY;
+    std::vector<double> mOriginZ;
+    std::vector<double> mInverseX;
+    std::vector<double> mInverseY;
+    std::vector<double> mInverseZ;
+    std::vector<double> mMaxT;
+
+};
+
+}
+
+#endif //COWPHYS_RAYPACKET_H
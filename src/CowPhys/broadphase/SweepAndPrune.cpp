@@ -0,0 +1,55 @@
+#include "SweepAndPrune.h"
+#include <algorithm>
+
+namespace cp {
+
+void SweepAndPrune::findPairs(const std::vector<DynBody *> &dynBodies, std::vector<DynPair> &dynPairs) {
+    mEntries.clear();
+    mActive.clear();
+    auto firstPair = dynPairs.size();
+
+    for (size_t i = 0; i < dynBodies.size(); ++i) {
+        auto body = dynBodies[i];
+        auto aabb = body->getWorldAABB();
+        mEntries.push_back({aabb.getMin(), aabb.getMax(), body, i, body->getCategory(), body->getCollisionMask(),
+                            body->getIgnoreGroup()});
+    }
+
+    // ties are broken on the creation order so the pair order never depends on addresses
+    std::sort(mEntries.begin(), mEntries.end(), [](const Entry &left, const Entry &right) {
+        if (left.min.x != right.min.x) {
+            return left.min.x < right.min.x;
+        }
+        return left.index < right.index;
+    });
+
+    for (auto &entry: mEntries) {
+        for (size_t i = 0; i < mActive.size();) {
+            if (mActive[i]->max.x < entry.min.x) {
+                mActive[i] = mActive.back();
+                mActive.pop_back();
+            } else {
+                ++i;
+            }
+        }
+
+        for (auto active: mActive) {
+            if (!canCollide(*active, entry) || !overlapsYZ(*active, entry)) {
+                continue;
+            }
+
+            if (active->body->getId() < entry.body->getId()) {
+                dynPairs.emplace_back(active->body, entry.body);
+            } else {
+                dynPairs.emplace_back(entry.body, active->body);
+            }
+        }
+
+        mActive.push_back(&entry);
+    }
+
+    // the sweep finds the pairs in x order, they are handed on in the order of the other broad phases
+    std::sort(dynPairs.begin() + static_cast<std::ptrdiff_t>(firstPair), dynPairs.end(), pairIdLess);
+}
+
+}
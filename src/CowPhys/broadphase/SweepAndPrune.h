@@ -0,0 +1,47 @@
+#ifndef COWPHYS_SWEEPANDPRUNE_H
+#define COWPHYS_SWEEPANDPRUNE_H
+
+#include <vector>
+#include "BroadPhase.h"
+
+namespace cp {
+
+// Sorts the world AABB of every dynamic body along the x axis and sweeps it once,
+// only reporting the pairs whose boxes also overlap on y and z.
+class SweepAndPrune {
+
+public:
+
+    void findPairs(const std::vector<DynBody *> &dynBodies, std::vector<DynPair> &dynPairs);
+
+private:
+
+    struct Entry {
+        Vec3U min;
+        Vec3U max;
+        DynBody *body;
+        size_t index;
+        uint32_t category;
+        uint32_t mask;
+        uint32_t ignoreGroup;
+    };
+
+    // Same test as Body::canCollideWith on the copies kept in the entries
+    static bool canCollide(const Entry &left, const Entry &right) {
+        return (left.category & right.mask) != 0 && (right.category & left.mask) != 0 &&
+               (left.ignoreGroup == 0 || left.ignoreGroup != right.ignoreGroup);
+    }
+
+    static bool overlapsYZ(const Entry &left, const Entry &right) {
+        return left.min.y <= right.max.y && right.min.y <= left.max.y &&
+               left.min.z <= right.max.z && right.min.z <= left.max.z;
+    }
+
+    std::vector<Entry> mEntries;
+    std::vector<const Entry *> mActive;
+
+};
+
+}
+
+#endif //COWPHYS_SWEEPANDPRUNE_H
@@ -10,6 +10,8 @@ class ContactListener {
 
 public:
 
+    virtual ~ContactListener() = default;
+
     virtual void onContactBegin(Body *left, Body *right) {
 
     }
@@ -5,11 +5,21 @@
 
 namespace cp {
 
+// Transform change of a body over a whole step, for worlds buffering their movement events
+struct MovementEvent {
+    Body *body;
+    Vec3U oldPos;
+    Vec3U newPos;
+    Vec3Small oldRotation;
+    Vec3Small newRotation;
+};
 
 class MovementListener {
 
 public:
 
+    virtual ~MovementListener() = default;
+
 
     virtual void onMove(Body *left, Vec3<Unit> oldPos) {
 
@@ -19,6 +29,12 @@ public:
 
     }
 
+    // Every body that moved or rotated during the step, in body order, called once after the step
+    // instead of onMove and onRotate when the world buffers its movement events
+    virtual void onMovements(const MovementEvent *events, size_t count) {
+
+    }
+
 
 };
 
@@ -1,6 +1,7 @@
 #ifndef COWPHYS_AABB_H
 #define COWPHYS_AABB_H
 
+#include <cstdlib>
 #include "Vec3.h"
 
 namespace cp {
@@ -9,16 +10,33 @@ template<class T>
 class AABB {
 public:
 
+    AABB() : pos(), halfSize() {}
+
     AABB(Vec3<T> pos, Vec3<T> halfSize) : pos(pos), halfSize(halfSize) {}
 
+    static AABB<T> fromMinMax(const Vec3<T> &min, const Vec3<T> &max) {
+        Vec3<T> half = (max - min) / 2;
+        // round the half size up so the box never shrinks on odd extents
+        half = half + (max - min) % 2;
+        return AABB<T>(min + (max - min) / 2, half);
+    }
+
     Vec3<T> pos;
     Vec3<T> halfSize;
 
-    bool collides(AABB<T> &other) {
+    Vec3<T> getMin() const {
+        return pos - halfSize;
+    }
+
+    Vec3<T> getMax() const {
+        return pos + halfSize;
+    }
+
+    bool collides(const AABB<T> &other) const {
         Vec3<T> delta = pos - other.pos;
-        return delta.x <= (halfSize.x + other.halfSize.x) &&
-               delta.y <= (halfSize.y + other.halfSize.y) &&
-               delta.z <= (halfSize.z + other.halfSize.z);
+        return std::abs(delta.x) <= (halfSize.x + other.halfSize.x) &&
+               std::abs(delta.y) <= (halfSize.y + other.halfSize.y) &&
+               std::abs(delta.z) <= (halfSize.z + other.halfSize.z);
     }
 
 };
@@ -0,0 +1,147 @@
+#ifndef COWPHYS_ROTATION_H
+#define COWPHYS_ROTATION_H
+
+#include <array>
+#include "Vec3.h"
+
+namespace cp {
+
+// Rotations are euler angles where a full turn is RotationSteps
+static constexpr int RotationSteps = 512;
+
+// Sin and cos are stored as fixed point numbers where RotationOne is 1.0
+static constexpr int RotationShift = 16;
+static constexpr Unit RotationOne = Unit(1) << RotationShift;
+
+namespace detail {
+
+constexpr double Pi = 3.14159265358979323846;
+
+// Taylor series, only ever evaluated at compile time on angles in [0, pi / 4]
+constexpr double taylorSin(double x) {
+    double term = x;
+    double sum = x;
+    for (int i = 1; i < 12; ++i) {
+        term = -term * x * x / ((2 * i) * (2 * i + 1));
+        sum += term;
+    }
+    return sum;
+}
+
+constexpr double taylorCos(double x) {
+    double term = 1;
+    double sum = 1;
+    for (int i = 1; i < 12; ++i) {
+        term = -term * x * x / ((2 * i - 1) * (2 * i));
+        sum += term;
+    }
+    return sum;
+}
+
+constexpr Unit roundFixed(double value) {
+    return value >= 0 ? static_cast<Unit>(value * RotationOne + 0.5) : -static_cast<Unit>(-value * RotationOne + 0.5);
+}
+
+// Builds the first octant with the series and mirrors it so the table is exactly symmetric
+constexpr std::array<Unit, RotationSteps> makeSinTable() {
+    std::array<Unit, RotationSteps> table{};
+    constexpr int quarter = RotationSteps / 4;
+    constexpr int eighth = RotationSteps / 8;
+    for (int i = 0; i <= eighth; ++i) {
+        double angle = (2.0 * Pi * i) / RotationSteps;
+        table[i] = roundFixed(taylorSin(angle));
+        table[quarter - i] = roundFixed(taylorCos(angle));
+    }
+    for (int i = 0; i < quarter; ++i) {
+        table[quarter + i] = table[quarter - i];
+        table[2 * quarter + i] = -table[i];
+        table[3 * quarter + i] = -table[quarter - i];
+    }
+    return table;
+}
+
+// Divides by 2^shift rounding half away from zero, like std::round does on the double path
+constexpr Unit roundShift(Unit value, int shift) {
+    Unit half = Unit(1) << (shift - 1);
+    return value >= 0 ? (value + half) >> shift : -((-value + half) >> shift);
+}
+
+}
+
+static constexpr std::array<Unit, RotationSteps> SinTable = detail::makeSinTable();
+
+constexpr int wrapRotation(SmallUnit step) {
+    return ((step % RotationSteps) + RotationSteps) % RotationSteps;
+}
+
+constexpr Unit fixedSin(SmallUnit step) {
+    return SinTable[wrapRotation(step)];
+}
+
+constexpr Unit fixedCos(SmallUnit step) {
+    return SinTable[wrapRotation(step + RotationSteps / 4)];
+}
+
+// Fixed point 3x3 matrix equivalent to Vec3::rotate, X is applied first, then Y, then Z.
+class RotationMatrix {
+
+public:
+
+    constexpr RotationMatrix() : m{{RotationOne, 0, 0}, {0, RotationOne, 0}, {0, 0, RotationOne}} {
+    }
+
+    static constexpr RotationMatrix fromEuler(const Vec3Small &euler) {
+        Unit cx = fixedCos(euler.x), sx = fixedSin(euler.x);
+        Unit cy = fixedCos(euler.y), sy = fixedSin(euler.y);
+        Unit cz = fixedCos(euler.z), sz = fixedSin(euler.z);
+
+        // every term is built with three fixed point factors and rounded once
+        constexpr int shift = 2 * RotationShift;
+        RotationMatrix result;
+        result.m[0][0] = detail::roundShift(cz * cy * RotationOne, shift);
+        result.m[0][1] = detail::roundShift(cz * sy * sx - sz * cx * RotationOne, shift);
+        result.m[0][2] = detail::roundShift(cz * sy * cx + sz * sx * RotationOne, shift);
+        result.m[1][0] = detail::roundShift(sz * cy * RotationOne, shift);
+        result.m[1][1] = detail::roundShift(sz * sy * sx + cz * cx * RotationOne, shift);
+        result.m[1][2] = detail::roundShift(sz * sy * cx - cz * sx * RotationOne, shift);
+        result.m[2][0] = -sy;
+        result.m[2][1] = detail::roundShift(cy * sx, RotationShift);
+        result.m[2][2] = detail::roundShift(cy * cx, RotationShift);
+        return result;
+    }
+
+    Vec3U apply(const Vec3U &v) const {
+        return {
+                detail::roundShift(m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z, RotationShift),
+                detail::roundShift(m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z, RotationShift),
+                detail::roundShift(m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z, RotationShift)
+        };
+    }
+
+    // The transpose, which is the inverse rotation
+    Vec3U applyInverse(const Vec3U &v) const {
+        return {
+                detail::roundShift(m[0][0] * v.x + m[1][0] * v.y + m[2][0] * v.z, RotationShift),
+                detail::roundShift(m[0][1] * v.x + m[1][1] * v.y + m[2][1] * v.z, RotationShift),
+                detail::roundShift(m[0][2] * v.x + m[1][2] * v.y + m[2][2] * v.z, RotationShift)
+        };
+    }
+
+    // Inverse rotation without rounding, for rays that have to keep their exact direction
+    void applyInverse(const Vec3U &v, double out[3]) const {
+        for (int i = 0; i < 3; ++i) {
+            out[i] = (static_cast<double>(m[0][i]) * v.x + static_cast<double>(m[1][i]) * v.y +
+                      static_cast<double>(m[2][i]) * v.z) / RotationOne;
+        }
+    }
+
+    Unit m[3][3];
+
+};
+
+static_assert(fixedSin(0) == 0 && fixedSin(RotationSteps / 4) == RotationOne, "sin table endpoints");
+static_assert(fixedCos(RotationSteps / 2) == -RotationOne, "cos table endpoints");
+
+}
+
+#endif //COWPHYS_ROTATION_H
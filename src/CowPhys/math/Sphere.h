@@ -2,6 +2,7 @@
 #define COWPHYS_SPHERE_H
 
 #include "Vec3.h"
+#include "Rotation.h"
 
 namespace cp {
 
@@ -18,11 +19,11 @@ public:
 
     }
 
-    bool collides(const Sphere<T> &other) {
+    bool collides(const Sphere<T> &other) const {
         return mPosition.distance(other.mPosition) < mRadius + other.mRadius;
     }
 
-    T penetration(const Sphere<T> &other) {
+    T penetration(const Sphere<T> &other) const {
         auto distance = mPosition.distance(other.mPosition);
         return std::abs(distance - (mRadius + other.mRadius));
     }
@@ -31,18 +32,30 @@ public:
         mPosition.rotate(euler);
     }
 
+    void rotateBy(const RotationMatrix &rotation) {
+        mPosition = rotation.apply(mPosition);
+    }
+
     void moveBy(const Vec3<T> &by) {
         mPosition = mPosition + by;
     }
 
-    Vec3<T> getPosition() {
+    Vec3<T> getPosition() const {
         return mPosition;
     }
 
-    T getRadius() {
+    T getRadius() const {
         return mRadius;
     }
 
+    bool contains(const Vec3<T> &point) const {
+        double dx = static_cast<double>(point.x - mPosition.x);
+        double dy = static_cast<double>(point.y - mPosition.y);
+        double dz = static_cast<double>(point.z - mPosition.z);
+        double radius = static_cast<double>(mRadius);
+        return dx * dx + dy * dy + dz * dz <= radius * radius;
+    }
+
     bool raycast(const Vec3<T> &origin, const Vec3<T> &dir, T &t) const {
         Vec3<T> oc = origin - mPosition;
         T a = dir.dot(dir);
@@ -51,10 +64,19 @@ public:
         T discriminant = b * b - 4 * a * c;
         if (discriminant < 0) {
             return false;
-        } else {
-            t = (-b - std::sqrt(discriminant)) / (2.0 * a);
+        }
+
+        // the ray starts at origin, only the roots in front of it count
+        auto root = std::sqrt(discriminant);
+        if (-b - root >= 0) {
+            t = (-b - root) / (2.0 * a);
+            return true;
+        }
+        if (-b + root >= 0) {
+            t = (-b + root) / (2.0 * a);
             return true;
         }
+        return false;
     }
 
 private:
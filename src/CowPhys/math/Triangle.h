@@ -2,6 +2,7 @@
 #define COWPHYS_TRIANGLE_H
 
 #include <array>
+#include <cmath>
 #include "Vec3.h"
 
 namespace cp {
@@ -18,6 +19,103 @@ public:
         return {p0, p1, p2};
     }
 
+    // Closest point of the triangle to p, written as doubles in closest. The math is done in doubles
+    // since the squared distances of large coordinates overflow integers.
+    void closestPoint(const Vec3<T> &p, double closest[3]) const {
+        double a[3] = {double(p0.x), double(p0.y), double(p0.z)};
+        double ab[3] = {double(p1.x - p0.x), double(p1.y - p0.y), double(p1.z - p0.z)};
+        double ac[3] = {double(p2.x - p0.x), double(p2.y - p0.y), double(p2.z - p0.z)};
+        double ap[3] = {double(p.x - p0.x), double(p.y - p0.y), double(p.z - p0.z)};
+        auto dot = [](const double *u, const double *v) {
+            return u[0] * v[0] + u[1] * v[1] + u[2] * v[2];
+        };
+        auto write = [&](double v, double w) {
+            for (int i = 0; i < 3; ++i) {
+                closest[i] = a[i] + ab[i] * v + ac[i] * w;
+            }
+        };
+
+        // Voronoi regions of the vertices, then of the edges, then the face
+        double d1 = dot(ab, ap), d2 = dot(ac, ap);
+        if (d1 <= 0 && d2 <= 0) {
+            return write(0, 0);
+        }
+
+        double bp[3] = {ap[0] - ab[0], ap[1] - ab[1], ap[2] - ab[2]};
+        double d3 = dot(ab, bp), d4 = dot(ac, bp);
+        if (d3 >= 0 && d4 <= d3) {
+            return write(1, 0);
+        }
+
+        double vc = d1 * d4 - d3 * d2;
+        if (vc <= 0 && d1 >= 0 && d3 <= 0) {
+            return write(d1 / (d1 - d3), 0);
+        }
+
+        double cp[3] = {ap[0] - ac[0], ap[1] - ac[1], ap[2] - ac[2]};
+        double d5 = dot(ab, cp), d6 = dot(ac, cp);
+        if (d6 >= 0 && d5 <= d6) {
+            return write(0, 1);
+        }
+
+        double vb = d5 * d2 - d1 * d6;
+        if (vb <= 0 && d2 >= 0 && d6 <= 0) {
+            return write(0, d2 / (d2 - d6));
+        }
+
+        double va = d3 * d6 - d5 * d4;
+        if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0) {
+            double w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+            return write(1 - w, w);
+        }
+
+        double denom = 1 / (va + vb + vc);
+        write(vb * denom, vc * denom);
+    }
+
+    // Both sides are hit, t is in multiples of dir like Sphere::raycast and hits behind origin are ignored
+    bool raycast(const Vec3<T> &origin, const Vec3<T> &dir, T &t) const {
+        double o[3] = {double(origin.x), double(origin.y), double(origin.z)};
+        double d[3] = {double(dir.x), double(dir.y), double(dir.z)};
+        double hit;
+        if (!raycast(o, d, hit)) {
+            return false;
+        }
+        t = static_cast<T>(hit);
+        return true;
+    }
+
+    // Same with a ray that does not sit on the integer grid, like one moved into mesh space
+    bool raycast(const double origin[3], const double d[3], double &t) const {
+        double e1[3] = {double(p1.x - p0.x), double(p1.y - p0.y), double(p1.z - p0.z)};
+        double e2[3] = {double(p2.x - p0.x), double(p2.y - p0.y), double(p2.z - p0.z)};
+        double h[3] = {d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0]};
+        double det = e1[0] * h[0] + e1[1] * h[1] + e1[2] * h[2];
+        if (det == 0) {
+            return false;
+        }
+
+        double inv = 1 / det;
+        double s[3] = {origin[0] - double(p0.x), origin[1] - double(p0.y), origin[2] - double(p0.z)};
+        double u = inv * (s[0] * h[0] + s[1] * h[1] + s[2] * h[2]);
+        if (u < 0 || u > 1) {
+            return false;
+        }
+
+        double q[3] = {s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0]};
+        double v = inv * (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]);
+        if (v < 0 || u + v > 1) {
+            return false;
+        }
+
+        double hit = inv * (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]);
+        if (hit < 0) {
+            return false;
+        }
+        t = hit;
+        return true;
+    }
+
     Vec3<T> p0;
     Vec3<T> p1;
     Vec3<T> p2;
@@ -23,7 +23,7 @@ public:
 
     }
 
-    bool isZero() {
+    bool isZero() const {
         return *this == Vec3<T>();
     }
 
@@ -68,7 +68,10 @@ public:
     }
 
     T distance(const Vec3 &rhs) const {
-        return std::sqrt(std::pow(x - rhs.x, 2) + std::pow(y - rhs.y, 2) + std::pow(z - rhs.z, 2));
+        double dx = static_cast<double>(x - rhs.x);
+        double dy = static_cast<double>(y - rhs.y);
+        double dz = static_cast<double>(z - rhs.z);
+        return static_cast<T>(std::sqrt(dx * dx + dy * dy + dz * dz));
     }
 
     T length() const {
@@ -164,6 +167,17 @@ public:
         }
     }
 
+    T operator[](int index) const {
+        switch (index) {
+            case 0:
+                return x;
+            case 1:
+                return y;
+            default:
+                return z;
+        }
+    }
+
     T x;
     T y;
     T z;
@@ -0,0 +1,28 @@
+#include "Profiler.h"
+#include <iomanip>
+
+namespace cp {
+
+void Profiler::writeTrace(std::ostream &out) const {
+    auto flags = out.flags();
+    auto precision = out.precision();
+    out << std::fixed << std::setprecision(3);
+
+    // complete events, their nesting comes from the times, everything runs on the stepping thread
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool wrapped = mEvents.size() == mCapacity;
+    for (size_t i = 0; i < mEvents.size(); ++i) {
+        auto &event = mEvents[wrapped ? (mNext + i) % mEvents.size() : i];
+        out << (i == 0 ? "\n" : ",\n")
+            << "{\"name\":\"" << event.name << "\",\"cat\":\"cowphys\",\"ph\":\"X\",\"pid\":1,\"tid\":1"
+            << ",\"ts\":" << static_cast<double>(event.start) / 1000
+            << ",\"dur\":" << static_cast<double>(event.duration) / 1000
+            << ",\"args\":{\"tick\":" << event.tick << "}}";
+    }
+    out << "\n]}\n";
+
+    out.flags(flags);
+    out.precision(precision);
+}
+
+}
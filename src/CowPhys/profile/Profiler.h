@@ -0,0 +1,161 @@
+#ifndef COWPHYS_PROFILER_H
+#define COWPHYS_PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// Timers and counters cost a clock read per phase and a thread local add per leaf, building with
+// COWPHYS_PROFILING set to 0 removes them altogether
+#ifndef COWPHYS_PROFILING
+#define COWPHYS_PROFILING 1
+#endif
+
+namespace cp {
+
+// Work done by the calling thread since it started, the hot loops bump it and the world reads it
+// back around the code it measures
+struct ProfileCounters {
+    uint64_t sphereTests = 0;
+    uint64_t nodeVisits = 0;
+};
+
+inline ProfileCounters &localProfileCounters() {
+    static thread_local ProfileCounters counters;
+    return counters;
+}
+
+struct TraceEvent {
+    const char *name;
+    uint64_t tick;
+    int64_t start; // nanoseconds since the profiler was created
+    int64_t duration;
+};
+
+// Keeps the most recent timed scopes in a ring, so a hitch can still be looked at after the fact
+class Profiler {
+
+public:
+
+    using Clock = std::chrono::steady_clock;
+
+    Profiler() : mOrigin(Clock::now()), mCapacity(0), mNext(0), mTick(0) {
+    }
+
+    // Number of scopes kept, 0 turns tracing off and drops the kept ones
+    void setTraceCapacity(size_t capacity) {
+        mCapacity = capacity;
+        mNext = 0;
+        mEvents.clear();
+        mEvents.shrink_to_fit();
+    }
+
+    size_t getTraceCapacity() const {
+        return mCapacity;
+    }
+
+    void setTick(uint64_t tick) {
+        mTick = tick;
+    }
+
+    void record(const char *name, Clock::time_point start, Clock::time_point end) {
+        if (mCapacity == 0) {
+            return;
+        }
+
+        TraceEvent event{name, mTick, std::chrono::duration_cast<std::chrono::nanoseconds>(start - mOrigin).count(),
+                         std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()};
+        if (mEvents.size() < mCapacity) {
+            mEvents.push_back(event);
+        } else {
+            mEvents[mNext] = event;
+        }
+        mNext = (mNext + 1) % mCapacity;
+    }
+
+    // Kept scopes from oldest to newest as Chrome trace JSON, which chrome://tracing and Perfetto open
+    void writeTrace(std::ostream &out) const;
+
+private:
+
+    Clock::time_point mOrigin;
+    std::vector<TraceEvent> mEvents;
+    size_t mCapacity;
+    size_t mNext;
+    uint64_t mTick;
+
+};
+
+// Adds the time until the end of the scope to milliseconds and hands the scope to the profiler
+class ProfileScope {
+
+public:
+
+    ProfileScope(Profiler &profiler, const char *name, double &milliseconds)
+            : mProfiler(profiler), mName(name), mMilliseconds(milliseconds), mStart(Profiler::Clock::now()) {
+    }
+
+    ~ProfileScope() {
+        auto end = Profiler::Clock::now();
+        mMilliseconds += std::chrono::duration<double, std::milli>(end - mStart).count();
+        mProfiler.record(mName, mStart, end);
+    }
+
+    ProfileScope(const ProfileScope &) = delete;
+
+    ProfileScope &operator=(const ProfileScope &) = delete;
+
+private:
+
+    Profiler &mProfiler;
+    const char *mName;
+    double &mMilliseconds;
+    Profiler::Clock::time_point mStart;
+
+};
+
+// Adds what the calling thread counted until the end of the scope to a total shared between threads
+class ProfileTally {
+
+public:
+
+    ProfileTally(uint64_t ProfileCounters::*counter, std::atomic<uint64_t> &total)
+            : mCounter(counter), mTotal(total), mStart(localProfileCounters().*counter) {
+    }
+
+    ~ProfileTally() {
+        mTotal.fetch_add(localProfileCounters().*mCounter - mStart, std::memory_order_relaxed);
+    }
+
+    ProfileTally(const ProfileTally &) = delete;
+
+    ProfileTally &operator=(const ProfileTally &) = delete;
+
+private:
+
+    uint64_t ProfileCounters::*mCounter;
+    std::atomic<uint64_t> &mTotal;
+    uint64_t mStart;
+
+};
+
+}
+
+#define COWPHYS_PROFILE_CONCAT_INNER(left, right) left##right
+#define COWPHYS_PROFILE_CONCAT(left, right) COWPHYS_PROFILE_CONCAT_INNER(left, right)
+
+#if COWPHYS_PROFILING
+#define COWPHYS_PROFILE_SCOPE(profiler, name, milliseconds) \
+    cp::ProfileScope COWPHYS_PROFILE_CONCAT(profileScope, __LINE__)(profiler, name, milliseconds)
+#define COWPHYS_PROFILE_TALLY(counter, total) \
+    cp::ProfileTally COWPHYS_PROFILE_CONCAT(profileTally, __LINE__)(&cp::ProfileCounters::counter, total)
+#define COWPHYS_PROFILE_COUNT(counter, amount) (cp::localProfileCounters().counter += (amount))
+#else
+#define COWPHYS_PROFILE_SCOPE(profiler, name, milliseconds) ((void) 0)
+#define COWPHYS_PROFILE_TALLY(counter, total) ((void) 0)
+#define COWPHYS_PROFILE_COUNT(counter, amount) ((void) 0)
+#endif
+
+#endif //COWPHYS_PROFILER_H
@@ -0,0 +1,136 @@
+#ifndef COWPHYS_BITSTREAM_H
+#define COWPHYS_BITSTREAM_H
+
+#include <cstdint>
+#include <vector>
+
+namespace cp {
+
+// Packs values of any bit width into bytes, least significant bits first
+class BitWriter {
+
+public:
+
+    explicit BitWriter(std::vector<uint8_t> &buffer) : mBuffer(buffer), mScratch(0), mScratchBits(0) {
+    }
+
+    ~BitWriter() {
+        flush();
+    }
+
+    void writeBits(uint64_t value, int count) {
+        while (count > 0) {
+            int taken = count < 32 ? count : 32;
+            mScratch |= (value & ((uint64_t(1) << taken) - 1)) << mScratchBits;
+            mScratchBits += taken;
+            value >>= taken;
+            count -= taken;
+            while (mScratchBits >= 8) {
+                mBuffer.push_back(static_cast<uint8_t>(mScratch));
+                mScratch >>= 8;
+                mScratchBits -= 8;
+            }
+        }
+    }
+
+    void writeBool(bool value) {
+        writeBits(value ? 1 : 0, 1);
+    }
+
+    // Small values take few bits, a two bit prefix tells which of 4, 8, 16 or 64 bits follow
+    void writeUnsigned(uint64_t value) {
+        if (value < (uint64_t(1) << 4)) {
+            writeBits(0, 2);
+            writeBits(value, 4);
+        } else if (value < (uint64_t(1) << 8)) {
+            writeBits(1, 2);
+            writeBits(value, 8);
+        } else if (value < (uint64_t(1) << 16)) {
+            writeBits(2, 2);
+            writeBits(value, 16);
+        } else {
+            writeBits(3, 2);
+            writeBits(value, 64);
+        }
+    }
+
+    // Zigzag encoded so small negative values stay small too
+    void writeSigned(int64_t value) {
+        writeUnsigned((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+    }
+
+    // Pads the last byte with zeros, the destructor does it as well
+    void flush() {
+        if (mScratchBits > 0) {
+            mBuffer.push_back(static_cast<uint8_t>(mScratch));
+            mScratch = 0;
+            mScratchBits = 0;
+        }
+    }
+
+private:
+
+    std::vector<uint8_t> &mBuffer;
+    uint64_t mScratch;
+    int mScratchBits;
+
+};
+
+// Reads what a BitWriter wrote, reading past the end returns zeros and marks the reader as overflowed
+class BitReader {
+
+public:
+
+    BitReader(const uint8_t *data, size_t size) : mData(data), mSize(size), mBit(0), mOverflow(false) {
+    }
+
+    uint64_t readBits(int count) {
+        if (count > static_cast<int64_t>(mSize * 8 - mBit)) {
+            mBit = mSize * 8;
+            mOverflow = true;
+            return 0;
+        }
+
+        uint64_t value = 0;
+        for (int done = 0; done < count;) {
+            size_t byte = mBit >> 3;
+            int offset = static_cast<int>(mBit & 7);
+            int taken = 8 - offset < count - done ? 8 - offset : count - done;
+            uint64_t bits = (mData[byte] >> offset) & ((1u << taken) - 1);
+            value |= bits << done;
+            done += taken;
+            mBit += taken;
+        }
+        return value;
+    }
+
+    bool readBool() {
+        return readBits(1) != 0;
+    }
+
+    uint64_t readUnsigned() {
+        static constexpr int Widths[] = {4, 8, 16, 64};
+        return readBits(Widths[readBits(2)]);
+    }
+
+    int64_t readSigned() {
+        auto value = readUnsigned();
+        return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+    }
+
+    bool hasOverflowed() const {
+        return mOverflow;
+    }
+
+private:
+
+    const uint8_t *mData;
+    size_t mSize;
+    size_t mBit;
+    bool mOverflow;
+
+};
+
+}
+
+#endif //COWPHYS_BITSTREAM_H
@@ -0,0 +1,99 @@
+#ifndef COWPHYS_BYTESTREAM_H
+#define COWPHYS_BYTESTREAM_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+#include "CowPhys/math/Vec3.h"
+
+namespace cp {
+
+// Appends raw values to a buffer, in the byte order of the machine
+class ByteWriter {
+
+public:
+
+    explicit ByteWriter(std::vector<uint8_t> &buffer) : mBuffer(buffer), mOffset(buffer.size()) {
+    }
+
+    // The buffer only reaches its final size once the writer is gone
+    ~ByteWriter() {
+        mBuffer.resize(mOffset);
+    }
+
+    template<class T>
+    void write(const T &value) {
+        static_assert(std::is_trivially_copyable<T>::value, "only plain values can be written");
+        if (mBuffer.size() - mOffset < sizeof(T)) {
+            mBuffer.resize(std::max(mBuffer.size() * 2, mOffset + sizeof(T)));
+        }
+        std::memcpy(mBuffer.data() + mOffset, &value, sizeof(T));
+        mOffset += sizeof(T);
+    }
+
+    template<class T>
+    void writeVec(const Vec3<T> &vec) {
+        write(vec.x);
+        write(vec.y);
+        write(vec.z);
+    }
+
+    void reserve(size_t bytes) {
+        if (mBuffer.size() < mOffset + bytes) {
+            mBuffer.resize(mOffset + bytes);
+        }
+    }
+
+private:
+
+    std::vector<uint8_t> &mBuffer;
+    size_t mOffset;
+
+};
+
+// Reads back what a ByteWriter wrote, every read past the end fails and leaves the value untouched
+class ByteReader {
+
+public:
+
+    ByteReader(const uint8_t *data, size_t size) : mData(data), mSize(size), mOffset(0) {
+    }
+
+    template<class T>
+    bool read(T &value) {
+        static_assert(std::is_trivially_copyable<T>::value, "only plain values can be read");
+        if (mSize - mOffset < sizeof(T)) {
+            mOffset = mSize;
+            return false;
+        }
+        std::memcpy(&value, mData + mOffset, sizeof(T));
+        mOffset += sizeof(T);
+        return true;
+    }
+
+    template<class T>
+    bool readVec(Vec3<T> &vec) {
+        return read(vec.x) && read(vec.y) && read(vec.z);
+    }
+
+    size_t getOffset() const {
+        return mOffset;
+    }
+
+    size_t getRemaining() const {
+        return mSize - mOffset;
+    }
+
+private:
+
+    const uint8_t *mData;
+    size_t mSize;
+    size_t mOffset;
+
+};
+
+}
+
+#endif //COWPHYS_BYTESTREAM_H
@@ -0,0 +1,342 @@
+#include "CookedAsset.h"
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+#include "CowPhys/shape/BoxShape.h"
+#include "CowPhys/shape/CompShape.h"
+#include "CowPhys/shape/MeshShape.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define COWPHYS_HAS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace cp {
+
+namespace {
+
+constexpr char AssetMagic[8] = {'C', 'P', 'A', 'S', 'S', 'E', 'T', '\0'};
+constexpr uint32_t AssetVersion = 1;
+constexpr uint32_t EndianTag = 0x01020304;
+constexpr uint64_t AssetAlignment = 8;
+
+enum class AssetKind : uint32_t {
+    Generic,
+    Box,
+    Comp,
+    Mesh
+};
+
+struct AssetArray {
+    uint64_t offset;
+    uint64_t count;
+};
+
+// The sizes of the engine structures are stored so a file cooked by a different build is refused
+struct AssetHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t endianTag;
+    uint32_t sphereSize;
+    uint32_t sphereNodeSize;
+    uint32_t triangleSize;
+    uint32_t triangleNodeSize;
+    uint32_t shapeSize;
+    uint32_t partSize;
+    uint64_t fileSize;
+    AssetArray shapes;
+};
+
+struct AssetShape {
+    AssetKind kind;
+    uint32_t reserved;
+    AssetArray name;
+    Vec3U halfSize;
+    AABB<Unit> aabb;
+    SphereU boundingSphere;
+    AssetArray spheres;
+    AssetArray sphereNodes;
+    AssetArray triangles;
+    AssetArray triangleNodes;
+    AssetArray parts;
+};
+
+// Parts always come before the compounds using them
+struct AssetPart {
+    uint32_t shape;
+    uint32_t reserved;
+    Vec3U position;
+};
+
+static_assert(std::is_trivially_copyable<SphereU>::value && std::is_trivially_copyable<SphereTreeNode>::value &&
+              std::is_trivially_copyable<TriangleU>::value && std::is_trivially_copyable<TriangleTreeNode>::value &&
+              std::is_trivially_copyable<AssetShape>::value, "cooked structures are copied as raw bytes");
+
+uint64_t align(uint64_t offset) {
+    return (offset + AssetAlignment - 1) & ~(AssetAlignment - 1);
+}
+
+template<class T>
+AssetArray reserveArray(uint64_t &end, size_t count) {
+    end = align(end);
+    AssetArray array{end, count};
+    end += count * sizeof(T);
+    return array;
+}
+
+template<class T>
+void copyArray(std::vector<uint8_t> &out, const AssetArray &array, const T *data) {
+    if (array.count > 0) {
+        std::memcpy(out.data() + array.offset, data, array.count * sizeof(T));
+    }
+}
+
+template<class T>
+bool validArray(const AssetArray &array, size_t size) {
+    return array.offset % alignof(T) == 0 && array.offset <= size &&
+           array.count <= (size - array.offset) / sizeof(T);
+}
+
+template<class T>
+ArrayView<T> viewArray(const uint8_t *data, const AssetArray &array) {
+    return ArrayView<T>(reinterpret_cast<const T *>(data + array.offset), array.count);
+}
+
+}
+
+uint32_t AssetCooker::addShape(const std::string &name, std::shared_ptr<const Shape> shape) {
+    return addShape(name, std::move(shape), true);
+}
+
+uint32_t AssetCooker::addShape(const std::string &name, std::shared_ptr<const Shape> shape, bool named) {
+    auto known = mIndices.find(shape.get());
+    if (known != mIndices.end()) {
+        if (named && mEntries[known->second].name.empty()) {
+            mEntries[known->second].name = name;
+        }
+        return known->second;
+    }
+
+    shape->prepare();
+    auto comp = dynamic_cast<const CompShape *>(shape.get());
+    if (comp != nullptr) {
+        for (auto &part: comp->getComposition()) {
+            addShape(std::string(), part.shape, false);
+        }
+    }
+
+    auto index = static_cast<uint32_t>(mEntries.size());
+    mIndices[shape.get()] = index;
+    mEntries.push_back({named ? name : std::string(), std::move(shape)});
+    return index;
+}
+
+void AssetCooker::cook(std::vector<uint8_t> &out) const {
+    AssetHeader header{};
+    std::memcpy(header.magic, AssetMagic, sizeof(AssetMagic));
+    header.version = AssetVersion;
+    header.endianTag = EndianTag;
+    header.sphereSize = sizeof(SphereU);
+    header.sphereNodeSize = sizeof(SphereTreeNode);
+    header.triangleSize = sizeof(TriangleU);
+    header.triangleNodeSize = sizeof(TriangleTreeNode);
+    header.shapeSize = sizeof(AssetShape);
+    header.partSize = sizeof(AssetPart);
+
+    // the layout is decided first, then everything is copied at its offset
+    uint64_t end = sizeof(AssetHeader);
+    header.shapes = reserveArray<AssetShape>(end, mEntries.size());
+    std::vector<AssetShape> shapes(mEntries.size());
+    std::vector<std::vector<AssetPart>> parts(mEntries.size());
+    for (size_t i = 0; i < mEntries.size(); ++i) {
+        auto &shape = *mEntries[i].shape;
+        auto &cooked = shapes[i];
+        cooked = AssetShape{};
+        cooked.kind = AssetKind::Generic;
+        cooked.aabb = shape.getAABB();
+        cooked.boundingSphere = shape.getBoundingSphere();
+        cooked.name = reserveArray<char>(end, mEntries[i].name.size());
+        cooked.spheres = reserveArray<SphereU>(end, shape.getSpheres().size());
+        cooked.sphereNodes = reserveArray<SphereTreeNode>(end, shape.getSphereTree().getNodes().size());
+
+        if (auto box = dynamic_cast<const BoxShape *>(&shape)) {
+            cooked.kind = AssetKind::Box;
+            cooked.halfSize = box->getHalfSize();
+        } else if (auto comp = dynamic_cast<const CompShape *>(&shape)) {
+            cooked.kind = AssetKind::Comp;
+            for (auto &part: comp->getComposition()) {
+                parts[i].push_back({mIndices.at(part.shape.get()), 0, part.position});
+            }
+            cooked.parts = reserveArray<AssetPart>(end, parts[i].size());
+        } else if (auto mesh = shape.asMesh()) {
+            cooked.kind = AssetKind::Mesh;
+            cooked.triangles = reserveArray<TriangleU>(end, mesh->getTriangles().size());
+            cooked.triangleNodes = reserveArray<TriangleTreeNode>(end, mesh->getTriangleTree().getNodes().size());
+        }
+    }
+    header.fileSize = align(end);
+
+    out.assign(header.fileSize, 0);
+    std::memcpy(out.data(), &header, sizeof(header));
+    copyArray(out, header.shapes, shapes.data());
+    for (size_t i = 0; i < mEntries.size(); ++i) {
+        auto &shape = *mEntries[i].shape;
+        auto &cooked = shapes[i];
+        copyArray(out, cooked.name, mEntries[i].name.data());
+        copyArray(out, cooked.spheres, shape.getSpheres().data());
+        copyArray(out, cooked.sphereNodes, shape.getSphereTree().getNodes().data());
+        copyArray(out, cooked.parts, parts[i].data());
+        if (auto mesh = shape.asMesh()) {
+            copyArray(out, cooked.triangles, mesh->getTriangles().data());
+            copyArray(out, cooked.triangleNodes, mesh->getTriangleTree().getNodes().data());
+        }
+    }
+}
+
+bool AssetCooker::write(const std::string &path) const {
+    std::vector<uint8_t> data;
+    cook(data);
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size()));
+    return static_cast<bool>(file);
+}
+
+std::shared_ptr<CookedAsset> CookedAsset::open(const std::string &path) {
+    std::shared_ptr<CookedAsset> asset(new CookedAsset());
+
+#ifdef COWPHYS_HAS_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat info{};
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+        ::close(fd);
+        return nullptr;
+    }
+    void *mapping = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        return nullptr;
+    }
+    asset->mData = static_cast<const uint8_t *>(mapping);
+    asset->mSize = static_cast<size_t>(info.st_size);
+    asset->mMapped = true;
+#else
+    // without mmap the file is read once, it is still used without parsing
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return nullptr;
+    }
+    asset->mFallback.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    asset->mData = asset->mFallback.data();
+    asset->mSize = asset->mFallback.size();
+#endif
+
+    return asset->load() ? asset : nullptr;
+}
+
+std::shared_ptr<CookedAsset> CookedAsset::fromMemory(const uint8_t *data, size_t size) {
+    std::shared_ptr<CookedAsset> asset(new CookedAsset());
+    asset->mData = data;
+    asset->mSize = size;
+    return asset->load() ? asset : nullptr;
+}
+
+CookedAsset::~CookedAsset() {
+    mShapes.clear();
+#ifdef COWPHYS_HAS_MMAP
+    if (mMapped) {
+        munmap(const_cast<uint8_t *>(mData), mSize);
+    }
+#endif
+}
+
+// Only the header and the shape table are checked and read, the bulk of the file is left to be
+// paged in when the simulation touches it
+bool CookedAsset::load() {
+    if (mSize < sizeof(AssetHeader) || reinterpret_cast<uintptr_t>(mData) % AssetAlignment != 0) {
+        return false;
+    }
+
+    AssetHeader header;
+    std::memcpy(&header, mData, sizeof(header));
+    if (std::memcmp(header.magic, AssetMagic, sizeof(AssetMagic)) != 0 || header.version != AssetVersion ||
+        header.endianTag != EndianTag || header.sphereSize != sizeof(SphereU) ||
+        header.sphereNodeSize != sizeof(SphereTreeNode) || header.triangleSize != sizeof(TriangleU) ||
+        header.triangleNodeSize != sizeof(TriangleTreeNode) || header.shapeSize != sizeof(AssetShape) ||
+        header.partSize != sizeof(AssetPart) || header.fileSize != mSize ||
+        !validArray<AssetShape>(header.shapes, mSize)) {
+        return false;
+    }
+
+    auto table = viewArray<AssetShape>(mData, header.shapes);
+    mShapes.reserve(table.size());
+    for (uint32_t i = 0; i < table.size(); ++i) {
+        auto &cooked = table[i];
+        if (!validArray<char>(cooked.name, mSize) || !validArray<SphereU>(cooked.spheres, mSize) ||
+            !validArray<SphereTreeNode>(cooked.sphereNodes, mSize) || !validArray<TriangleU>(cooked.triangles, mSize) ||
+            !validArray<TriangleTreeNode>(cooked.triangleNodes, mSize) || !validArray<AssetPart>(cooked.parts, mSize)) {
+            return false;
+        }
+
+        CookedShapeData data;
+        data.spheres = viewArray<SphereU>(mData, cooked.spheres);
+        data.sphereNodes = viewArray<SphereTreeNode>(mData, cooked.sphereNodes);
+        data.aabb = cooked.aabb;
+        data.boundingSphere = cooked.boundingSphere;
+
+        switch (cooked.kind) {
+            case AssetKind::Generic:
+                mShapes.emplace_back(new Shape(data));
+                break;
+            case AssetKind::Box:
+                mShapes.emplace_back(new BoxShape(cooked.halfSize, data));
+                break;
+            case AssetKind::Mesh:
+                mShapes.emplace_back(new MeshShape(viewArray<TriangleU>(mData, cooked.triangles),
+                                                   viewArray<TriangleTreeNode>(mData, cooked.triangleNodes), data));
+                break;
+            case AssetKind::Comp: {
+                std::vector<Comp> compositions;
+                for (auto &part: viewArray<AssetPart>(mData, cooked.parts)) {
+                    if (part.shape >= i) {
+                        return false;
+                    }
+                    // the asset owns every shape, parts hold them without keeping the asset alive
+                    Comp comp;
+                    comp.shape = std::shared_ptr<const Shape>(std::shared_ptr<const Shape>(), mShapes[part.shape].get());
+                    comp.position = part.position;
+                    compositions.push_back(comp);
+                }
+                mShapes.emplace_back(new CompShape(std::move(compositions), data));
+                break;
+            }
+            default:
+                return false;
+        }
+
+        if (cooked.name.count > 0) {
+            mNames[std::string(reinterpret_cast<const char *>(mData + cooked.name.offset), cooked.name.count)] = i;
+        }
+    }
+
+    return true;
+}
+
+std::shared_ptr<const Shape> CookedAsset::getShape(const std::string &name) {
+    auto it = mNames.find(name);
+    return it == mNames.end() ? nullptr : getShape(it->second);
+}
+
+std::shared_ptr<const Shape> CookedAsset::getShape(uint32_t index) {
+    if (index >= mShapes.size()) {
+        return nullptr;
+    }
+    return std::shared_ptr<const Shape>(shared_from_this(), mShapes[index].get());
+}
+
+}
@@ -0,0 +1,86 @@
+#ifndef COWPHYS_COOKEDASSET_H
+#define COWPHYS_COOKEDASSET_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "CowPhys/shape/Shape.h"
+
+namespace cp {
+
+// Writes shapes with their spheres, sphere trees, triangles and triangle trees into one file that
+// CookedAsset maps and uses as is. Everything in the file is addressed by offsets from its start.
+// The file is tied to the layout of the engine structures and to the byte order of the machine
+// that cooked it, both are checked when it is opened.
+class AssetCooker {
+
+public:
+
+    // Parts of compounds are added along with them, unnamed. Returns the index of the shape.
+    uint32_t addShape(const std::string &name, std::shared_ptr<const Shape> shape);
+
+    void cook(std::vector<uint8_t> &out) const;
+
+    bool write(const std::string &path) const;
+
+private:
+
+    uint32_t addShape(const std::string &name, std::shared_ptr<const Shape> shape, bool named);
+
+    struct Entry {
+        std::string name;
+        std::shared_ptr<const Shape> shape;
+    };
+
+    std::vector<Entry> mEntries;
+    std::unordered_map<const Shape *, uint32_t> mIndices;
+
+};
+
+// A cooked file mapped in memory, its shapes view the mapping directly so opening costs no parsing
+// of the spheres and trees, and processes mapping the same file share its pages.
+class CookedAsset : public std::enable_shared_from_this<CookedAsset> {
+
+public:
+
+    // Returns nullptr when the file cannot be read or was not cooked for this build
+    static std::shared_ptr<CookedAsset> open(const std::string &path);
+
+    // Same from memory owned by the caller, which must outlive the asset and be 8 byte aligned
+    static std::shared_ptr<CookedAsset> fromMemory(const uint8_t *data, size_t size);
+
+    ~CookedAsset();
+
+    CookedAsset(const CookedAsset &) = delete;
+
+    CookedAsset &operator=(const CookedAsset &) = delete;
+
+    size_t getShapeCount() const {
+        return mShapes.size();
+    }
+
+    // The shapes keep the asset alive, nullptr for an unknown name or index
+    std::shared_ptr<const Shape> getShape(const std::string &name);
+
+    std::shared_ptr<const Shape> getShape(uint32_t index);
+
+private:
+
+    CookedAsset() = default;
+
+    bool load();
+
+    const uint8_t *mData = nullptr;
+    size_t mSize = 0;
+    bool mMapped = false;
+    std::vector<uint8_t> mFallback;
+    std::vector<std::unique_ptr<Shape>> mShapes;
+    std::unordered_map<std::string, uint32_t> mNames;
+
+};
+
+}
+
+#endif //COWPHYS_COOKEDASSET_H
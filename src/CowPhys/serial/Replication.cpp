@@ -0,0 +1,218 @@
+#include "Replication.h"
+#include <algorithm>
+#include <limits>
+#include "BitStream.h"
+
+namespace cp {
+
+namespace {
+
+constexpr int RotationBits = 9;
+constexpr int HandleBits = 32;
+constexpr uint32_t PacketVersion = 1;
+
+static_assert(RotationSteps == 1 << RotationBits, "rotations are packed on 9 bits");
+
+void writeVec(BitWriter &writer, const Vec3U &vec) {
+    writer.writeSigned(vec.x);
+    writer.writeSigned(vec.y);
+    writer.writeSigned(vec.z);
+}
+
+Vec3U readVec(BitReader &reader) {
+    Unit x = reader.readSigned();
+    Unit y = reader.readSigned();
+    Unit z = reader.readSigned();
+    return {x, y, z};
+}
+
+void writeRotation(BitWriter &writer, const Vec3Small &rotation) {
+    writer.writeBits(static_cast<uint64_t>(rotation.x), RotationBits);
+    writer.writeBits(static_cast<uint64_t>(rotation.y), RotationBits);
+    writer.writeBits(static_cast<uint64_t>(rotation.z), RotationBits);
+}
+
+Vec3Small readRotation(BitReader &reader) {
+    auto x = static_cast<SmallUnit>(reader.readBits(RotationBits));
+    auto y = static_cast<SmallUnit>(reader.readBits(RotationBits));
+    auto z = static_cast<SmallUnit>(reader.readBits(RotationBits));
+    return {x, y, z};
+}
+
+}
+
+void ReplicationSnapshot::capture(PhysWorld &world, int shift) {
+    positionShift = shift;
+    auto &dynBodies = world.getDynBodies();
+    bodies.resize(dynBodies.size());
+    for (size_t i = 0; i < dynBodies.size(); ++i) {
+        auto body = dynBodies[i];
+        auto pos = body->getPos();
+        auto rotation = body->getRotation();
+        auto &replicated = bodies[i];
+        replicated.handle = body->getHandle();
+        replicated.pos = shift == 0 ? pos : Vec3U(detail::roundShift(pos.x, shift),
+                                                  detail::roundShift(pos.y, shift),
+                                                  detail::roundShift(pos.z, shift));
+        replicated.rotation = Vec3Small(wrapRotation(rotation.x), wrapRotation(rotation.y),
+                                        wrapRotation(rotation.z));
+    }
+
+    // the body list is only reordered by removals, so this is nearly sorted already
+    std::sort(bodies.begin(), bodies.end(), [](const ReplicatedBody &left, const ReplicatedBody &right) {
+        return left.handle.index < right.handle.index;
+    });
+}
+
+// Packet layout: version, position shift, then the bodies that were removed and the ones that
+// changed, both walked by handle index and stored as the gap from the previous one
+void ReplicationEncoder::encode(const ReplicationSnapshot &baseline, const ReplicationSnapshot &current,
+                                std::vector<uint8_t> &out) {
+    BitWriter writer(out);
+    writer.writeUnsigned(PacketVersion);
+    writer.writeUnsigned(static_cast<uint64_t>(current.positionShift));
+    // a baseline quantized differently cannot be diffed against, everything is sent in full
+    bool sameShift = baseline.positionShift == current.positionShift;
+
+    auto &oldBodies = baseline.bodies;
+    auto &newBodies = current.bodies;
+
+    // removed bodies, their slot is gone or holds another generation now
+    size_t removedCount = 0;
+    for (size_t i = 0, j = 0; i < oldBodies.size(); ++i) {
+        while (j < newBodies.size() && newBodies[j].handle.index < oldBodies[i].handle.index) {
+            ++j;
+        }
+        if (j == newBodies.size() || newBodies[j].handle != oldBodies[i].handle) {
+            ++removedCount;
+        }
+    }
+
+    writer.writeUnsigned(removedCount);
+    int64_t previous = -1;
+    for (size_t i = 0, j = 0; i < oldBodies.size(); ++i) {
+        while (j < newBodies.size() && newBodies[j].handle.index < oldBodies[i].handle.index) {
+            ++j;
+        }
+        if (j == newBodies.size() || newBodies[j].handle != oldBodies[i].handle) {
+            writer.writeUnsigned(oldBodies[i].handle.index - previous - 1);
+            previous = oldBodies[i].handle.index;
+        }
+    }
+
+    // changed bodies, terminated by a zero flag so the count does not need a second pass
+    previous = -1;
+    for (size_t i = 0, j = 0; j < newBodies.size(); ++j) {
+        auto &body = newBodies[j];
+        while (i < oldBodies.size() && oldBodies[i].handle.index < body.handle.index) {
+            ++i;
+        }
+
+        const ReplicatedBody *old = nullptr;
+        if (sameShift && i < oldBodies.size() && oldBodies[i].handle == body.handle) {
+            old = &oldBodies[i];
+            if (old->pos == body.pos && old->rotation == body.rotation) {
+                continue;
+            }
+        }
+
+        writer.writeBool(true);
+        writer.writeUnsigned(body.handle.index - previous - 1);
+        previous = body.handle.index;
+
+        writer.writeBool(old == nullptr);
+        if (old == nullptr) {
+            writer.writeBits(body.handle.generation, HandleBits);
+            writeVec(writer, body.pos);
+            writeRotation(writer, body.rotation);
+            continue;
+        }
+
+        bool moved = old->pos != body.pos;
+        bool rotated = old->rotation != body.rotation;
+        writer.writeBool(moved);
+        writer.writeBool(rotated);
+        if (moved) {
+            writeVec(writer, body.pos - old->pos);
+        }
+        if (rotated) {
+            writeRotation(writer, body.rotation);
+        }
+    }
+    writer.writeBool(false);
+}
+
+bool ReplicationDecoder::decode(const ReplicationSnapshot &baseline, const uint8_t *data, size_t size,
+                                ReplicationSnapshot &current) {
+    BitReader reader(data, size);
+    if (reader.readUnsigned() != PacketVersion) {
+        return false;
+    }
+    auto shift = static_cast<int>(reader.readUnsigned());
+    bool sameShift = baseline.positionShift == shift;
+
+    current.positionShift = shift;
+    current.bodies.clear();
+
+    auto &oldBodies = baseline.bodies;
+    auto removedCount = reader.readUnsigned();
+    std::vector<bool> removed(oldBodies.size(), false);
+    int64_t index = -1;
+    for (size_t i = 0, k = 0; k < removedCount && !reader.hasOverflowed(); ++k) {
+        index += static_cast<int64_t>(reader.readUnsigned()) + 1;
+        while (i < oldBodies.size() && oldBodies[i].handle.index < index) {
+            ++i;
+        }
+        if (i == oldBodies.size() || oldBodies[i].handle.index != index) {
+            return false;
+        }
+        removed[i] = true;
+    }
+
+    // merges the unchanged baseline bodies with the changed ones, both ordered by index
+    size_t i = 0;
+    auto keepUntil = [&](int64_t end) {
+        for (; i < oldBodies.size() && oldBodies[i].handle.index < end; ++i) {
+            if (!removed[i] && sameShift) {
+                current.bodies.push_back(oldBodies[i]);
+            }
+        }
+    };
+
+    index = -1;
+    while (reader.readBool() && !reader.hasOverflowed()) {
+        index += static_cast<int64_t>(reader.readUnsigned()) + 1;
+        keepUntil(index);
+
+        ReplicatedBody body;
+        body.handle.index = static_cast<uint32_t>(index);
+        if (reader.readBool()) {
+            body.handle.generation = static_cast<uint32_t>(reader.readBits(HandleBits));
+            body.pos = readVec(reader);
+            body.rotation = readRotation(reader);
+            // a body created in a slot of the baseline replaces it
+            if (i < oldBodies.size() && oldBodies[i].handle.index == index) {
+                ++i;
+            }
+        } else {
+            if (!sameShift || i == oldBodies.size() || oldBodies[i].handle.index != index || removed[i]) {
+                return false;
+            }
+            body = oldBodies[i++];
+            bool moved = reader.readBool();
+            bool rotated = reader.readBool();
+            if (moved) {
+                body.pos = body.pos + readVec(reader);
+            }
+            if (rotated) {
+                body.rotation = readRotation(reader);
+            }
+        }
+        current.bodies.push_back(body);
+    }
+    keepUntil(std::numeric_limits<int64_t>::max());
+
+    return !reader.hasOverflowed();
+}
+
+}
@@ -0,0 +1,63 @@
+#ifndef COWPHYS_REPLICATION_H
+#define COWPHYS_REPLICATION_H
+
+#include <cstdint>
+#include <vector>
+#include "CowPhys/PhysWorld.h"
+
+namespace cp {
+
+// Transform of a DynBody as the clients see it, the position is quantized and the rotation wrapped
+// to RotationSteps so it fits in 9 bits per axis
+struct ReplicatedBody {
+    BodyHandle handle;
+    Vec3U pos;
+    Vec3Small rotation;
+};
+
+// Every DynBody of a world at one tick, ordered by handle index. An empty snapshot is the
+// baseline of a client that has not acknowledged anything yet.
+struct ReplicationSnapshot {
+    // positions are stored divided by 2^positionShift, rounded
+    int positionShift = 0;
+    std::vector<ReplicatedBody> bodies;
+
+    void capture(PhysWorld &world, int shift = 0);
+
+    // World position of a quantized one
+    Vec3U toWorldPos(const Vec3U &pos) const {
+        return Vec3U(pos.x * (Unit(1) << positionShift), pos.y * (Unit(1) << positionShift),
+                     pos.z * (Unit(1) << positionShift));
+    }
+};
+
+// Writes the difference between the baseline a client acknowledged and the current snapshot:
+// the bodies that moved, appeared or disappeared, nothing for the others.
+class ReplicationEncoder {
+
+public:
+
+    // Appends the packet to out
+    static void encode(const ReplicationSnapshot &baseline, const ReplicationSnapshot &current,
+                       std::vector<uint8_t> &out);
+
+};
+
+class ReplicationDecoder {
+
+public:
+
+    // Rebuilds the snapshot encode was given from the same baseline, false on a damaged packet
+    static bool decode(const ReplicationSnapshot &baseline, const uint8_t *data, size_t size,
+                       ReplicationSnapshot &current);
+
+    static bool decode(const ReplicationSnapshot &baseline, const std::vector<uint8_t> &packet,
+                       ReplicationSnapshot &current) {
+        return decode(baseline, packet.data(), packet.size(), current);
+    }
+
+};
+
+}
+
+#endif //COWPHYS_REPLICATION_H
@@ -17,12 +17,17 @@ public:
 
     explicit BoxShape(Vec3U halfSize) : mHalfSize(halfSize) {
         setupSpheres();
+        prepare();
     }
 
     BoxShape(Unit halfX, Unit halfY, Unit halfZ) : BoxShape(Vec3U(halfX, halfY, halfZ)) {
     }
 
-    Vec3U getHalfSize() {
+    // Views spheres cooked for this size instead of packing them again
+    BoxShape(Vec3U halfSize, const CookedShapeData &data) : Shape(data), mHalfSize(halfSize) {
+    }
+
+    Vec3U getHalfSize() const {
         return mHalfSize;
     }
 
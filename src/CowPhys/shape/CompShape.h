@@ -1,6 +1,7 @@
 #ifndef COWPHYS_COMPSHAPE_H
 #define COWPHYS_COMPSHAPE_H
 
+#include <memory>
 #include <utility>
 #include <vector>
 #include "Shape.h"
@@ -8,7 +9,7 @@
 namespace cp {
 
 struct Comp {
-    Shape *shape;
+    std::shared_ptr<const Shape> shape;
     Vec3U position;
 };
 
@@ -19,19 +20,30 @@ public:
     explicit CompShape() {
     }
 
+    // Views cooked spheres, the parts are only kept to describe the compound
+    CompShape(std::vector<Comp> compositions, const CookedShapeData &data)
+            : Shape(data), mCompositions(std::move(compositions)) {
+    }
+
+    // Takes ownership of the shape, use the shared overload to put one shape in several places
     void addShape(Shape *shape, Vec3U pos) {
+        addShape(std::shared_ptr<const Shape>(shape), pos);
+    }
+
+    void addShape(std::shared_ptr<const Shape> shape, Vec3U pos) {
         auto comp = Comp();
-        comp.shape = shape;
+        comp.shape = std::move(shape);
         comp.position = pos;
         mCompositions.push_back(comp);
 
-        for (auto sphere: shape->getSpheres()) {
+        for (auto sphere: comp.shape->getSpheres()) {
             sphere.moveBy(pos);
             addSphere(sphere);
         }
+        prepare();
     }
 
-    const std::vector<Comp> &getComposition() {
+    const std::vector<Comp> &getComposition() const {
         return mCompositions;
     }
 
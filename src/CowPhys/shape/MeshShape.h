@@ -5,6 +5,7 @@
 #include <vector>
 #include "Shape.h"
 #include "CowPhys/math/Triangle.h"
+#include "TriangleTree.h"
 
 namespace cp {
 
@@ -14,12 +15,32 @@ public:
 
     MeshShape() {}
 
+    // Builds the triangle tree right away, which reorders the triangles
     MeshShape(std::vector<TriangleU> triangles) : mTriangles(std::move(triangles)) {
         toCounterWise();
+        mTriangleTree.build(mTriangles);
+        if (!mTriangleTree.empty()) {
+            auto &root = mTriangleTree.getNodes().front();
+            setBounds(root.min, root.max);
+        }
+    }
+
+    // Views cooked triangles and tree, already ordered and built
+    MeshShape(ArrayView<TriangleU> triangles, ArrayView<TriangleTreeNode> nodes, const CookedShapeData &data)
+            : Shape(data), mExternalTriangles(triangles) {
+        mTriangleTree.view(nodes);
+    }
+
+    ArrayView<TriangleU> getTriangles() const {
+        return isCooked() ? mExternalTriangles : ArrayView<TriangleU>(mTriangles);
+    }
+
+    const TriangleTree &getTriangleTree() const {
+        return mTriangleTree;
     }
 
-    const std::vector<TriangleU> &getTriangles() {
-        return mTriangles;
+    const MeshShape *asMesh() const override {
+        return this;
     }
 
 private:
@@ -43,6 +64,8 @@ private:
     }
 
     std::vector<TriangleU> mTriangles;
+    ArrayView<TriangleU> mExternalTriangles;
+    TriangleTree mTriangleTree;
 
 };
 
@@ -1,16 +1,39 @@
 #ifndef COWPHYS_SHAPE_H
 #define COWPHYS_SHAPE_H
 
+#include <cmath>
+#include <limits>
 #include <vector>
 #include "CowPhys/math/Sphere.h"
+#include "CowPhys/math/AABB.h"
+#include "CowPhys/ArrayView.h"
+#include "SphereTree.h"
 
 namespace cp {
 
+class MeshShape;
+
+// Spheres, tree and bounds of a shape living in memory the shape does not own, like a mapped
+// cooked asset, which has to outlive the shape
+struct CookedShapeData {
+    ArrayView<SphereU> spheres;
+    ArrayView<SphereTreeNode> sphereNodes;
+    AABB<Unit> aabb;
+    SphereU boundingSphere;
+};
+
 class Shape {
 
 public:
 
-    Shape() : mUserData(nullptr) {
+    Shape() : mUserData(nullptr), mVersion(0), mTreeDirty(false) {
+    }
+
+    // Views cooked data without copying it, spheres cannot be added to such a shape
+    explicit Shape(const CookedShapeData &data) : mExternalSpheres(data.spheres), mBoundingSphere(data.boundingSphere),
+                                                  mAABB(data.aabb), mUserData(nullptr), mVersion(0),
+                                                  mTreeDirty(false), mCooked(true) {
+        mSphereTree.view(data.sphereNodes);
     }
 
     virtual ~Shape() = default;
@@ -24,16 +47,128 @@ public:
     }
 
     void addSphere(SphereU sphere) {
+        if (isCooked()) {
+            return;
+        }
         mSpheres.emplace_back(sphere);
+        growBounds(sphere);
+        mTreeDirty = true;
+        ++mVersion;
+    }
+
+    // Builds the sphere tree if spheres were added since the last build. The builders call it once
+    // they are done and the world calls it when a body is created, it reorders the spheres but does
+    // not change the shape, which is why it works on shared const shapes.
+    void prepare() const {
+        if (mTreeDirty) {
+            mSphereTree.build(mSpheres);
+            mTreeDirty = false;
+            ++mVersion;
+        }
+    }
+
+    const SphereTree &getSphereTree() const {
+        return mSphereTree;
+    }
+
+    // Changes every time the spheres are added to or reordered
+    uint32_t getVersion() const {
+        return mVersion;
+    }
+
+    ArrayView<SphereU> getSpheres() const {
+        return isCooked() ? mExternalSpheres : ArrayView<SphereU>(mSpheres);
+    }
+
+    // Whether the shape views cooked data instead of owning its spheres
+    bool isCooked() const {
+        return mCooked;
+    }
+
+    // Local space sphere enclosing every sphere of the shape
+    const SphereU &getBoundingSphere() const {
+        return mBoundingSphere;
+    }
+
+    // Local space box enclosing every sphere of the shape
+    const AABB<Unit> &getAABB() const {
+        return mAABB;
+    }
+
+    // Meshes collide through their triangles rather than spheres
+    virtual const MeshShape *asMesh() const {
+        return nullptr;
     }
 
-    const std::vector<SphereU> &getSpheres() {
-        return mSpheres;
+protected:
+
+    // For shapes without spheres, the bounding sphere encloses the box
+    void setBounds(const Vec3U &min, const Vec3U &max) {
+        mMin = min;
+        mMax = max;
+        mAABB = AABB<Unit>::fromMinMax(min, max);
+        auto half = mAABB.halfSize;
+        double reach = std::sqrt(static_cast<double>(half.x) * half.x + static_cast<double>(half.y) * half.y +
+                                 static_cast<double>(half.z) * half.z);
+        mBoundingSphere = SphereU(mAABB.pos, static_cast<Unit>(std::ceil(reach)) + 1);
+        ++mVersion;
     }
 
 private:
-    std::vector<SphereU> mSpheres;
+
+    void growBounds(const SphereU &sphere) {
+        Vec3U radius(sphere.getRadius());
+        mMin = mMin.min(sphere.getPosition() - radius);
+        mMax = mMax.max(sphere.getPosition() + radius);
+        mAABB = AABB<Unit>::fromMinMax(mMin, mMax);
+
+        if (mSpheres.size() == 1) {
+            mBoundingSphere = sphere;
+            return;
+        }
+
+        // grow the bounding sphere just enough to enclose both, rounding the radius up
+        auto center = mBoundingSphere.getPosition();
+        auto delta = sphere.getPosition() - center;
+        double distance = std::sqrt(static_cast<double>(delta.x) * delta.x +
+                                    static_cast<double>(delta.y) * delta.y +
+                                    static_cast<double>(delta.z) * delta.z);
+        double radiusA = static_cast<double>(mBoundingSphere.getRadius());
+        double radiusB = static_cast<double>(sphere.getRadius());
+        if (distance + radiusB <= radiusA) {
+            return;
+        }
+        if (distance + radiusA <= radiusB) {
+            mBoundingSphere = sphere;
+            return;
+        }
+
+        double newRadius = (distance + radiusA + radiusB) / 2;
+        double factor = (newRadius - radiusA) / distance;
+        Vec3U newCenter(center.x + static_cast<Unit>(std::llround(delta.x * factor)),
+                        center.y + static_cast<Unit>(std::llround(delta.y * factor)),
+                        center.z + static_cast<Unit>(std::llround(delta.z * factor)));
+        auto reach = [&newCenter](const Vec3U &pos, double radius) {
+            auto offset = pos - newCenter;
+            return std::sqrt(static_cast<double>(offset.x) * offset.x +
+                             static_cast<double>(offset.y) * offset.y +
+                             static_cast<double>(offset.z) * offset.z) + radius;
+        };
+        double enclosing = std::max(reach(center, radiusA), reach(sphere.getPosition(), radiusB));
+        mBoundingSphere = SphereU(newCenter, static_cast<Unit>(std::ceil(enclosing)) + 1);
+    }
+
+    mutable std::vector<SphereU> mSpheres;
+    ArrayView<SphereU> mExternalSpheres;
+    mutable SphereTree mSphereTree;
+    SphereU mBoundingSphere;
+    AABB<Unit> mAABB;
+    Vec3U mMin = Vec3U(std::numeric_limits<Unit>::max());
+    Vec3U mMax = Vec3U(std::numeric_limits<Unit>::min());
     void *mUserData;
+    mutable uint32_t mVersion;
+    mutable bool mTreeDirty;
+    bool mCooked = false;
 
 };
 
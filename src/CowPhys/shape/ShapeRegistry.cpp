@@ -0,0 +1,115 @@
+#include "ShapeRegistry.h"
+
+namespace cp {
+
+std::shared_ptr<const BoxShape> ShapeRegistry::getBox(const Vec3U &halfSize) {
+    Key key{static_cast<Unit>(ShapeKind::Box)};
+    appendVec(key, halfSize);
+    return intern<BoxShape>(key, [&halfSize]() {
+        return new BoxShape(halfSize);
+    });
+}
+
+std::shared_ptr<const CompShape> ShapeRegistry::getComp(const std::vector<CompPart> &parts) {
+    Key key{static_cast<Unit>(ShapeKind::Comp)};
+    for (auto &part: parts) {
+        // a part address can only come back once the compound holding it is gone too
+        key.push_back(static_cast<Unit>(reinterpret_cast<uintptr_t>(part.shape.get())));
+        appendVec(key, part.position);
+    }
+    return intern<CompShape>(key, [&parts]() {
+        auto comp = new CompShape();
+        for (auto &part: parts) {
+            comp->addShape(part.shape, part.position);
+        }
+        return comp;
+    });
+}
+
+std::shared_ptr<const MeshShape> ShapeRegistry::getMesh(const std::vector<TriangleU> &triangles) {
+    auto hash = hashTriangles(triangles);
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto range = mMeshes.equal_range(hash);
+    for (auto it = range.first; it != range.second;) {
+        auto mesh = it->second.mesh.lock();
+        if (mesh == nullptr) {
+            // freed meshes are dropped as lookups come across them
+            it = mMeshes.erase(it);
+            continue;
+        }
+        if (sameTriangles(it->second.triangles, triangles)) {
+            return mesh;
+        }
+        ++it;
+    }
+
+    std::shared_ptr<const MeshShape> created(new MeshShape(triangles));
+    created->prepare();
+    mMeshes.emplace(hash, MeshEntry{created, triangles});
+    return created;
+}
+
+size_t ShapeRegistry::size() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto it = mShapes.begin(); it != mShapes.end();) {
+        it = it->second.expired() ? mShapes.erase(it) : std::next(it);
+    }
+    for (auto it = mMeshes.begin(); it != mMeshes.end();) {
+        it = it->second.mesh.expired() ? mMeshes.erase(it) : std::next(it);
+    }
+    return mShapes.size() + mMeshes.size();
+}
+
+uint64_t ShapeRegistry::hashTriangles(const std::vector<TriangleU> &triangles) {
+    // FNV-1a over every coordinate
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&hash](const Vec3U &vec) {
+        for (auto value: {vec.x, vec.y, vec.z}) {
+            hash = (hash ^ static_cast<uint64_t>(value)) * 1099511628211ull;
+        }
+    };
+    for (auto &triangle: triangles) {
+        mix(triangle.p0);
+        mix(triangle.p1);
+        mix(triangle.p2);
+    }
+    return hash;
+}
+
+bool ShapeRegistry::sameTriangles(const std::vector<TriangleU> &left, const std::vector<TriangleU> &right) {
+    if (left.size() != right.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < left.size(); ++i) {
+        auto &a = left[i];
+        auto &b = right[i];
+        if (a.p0 != b.p0 || a.p1 != b.p1 || a.p2 != b.p2) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template<class T, class Build>
+std::shared_ptr<const T> ShapeRegistry::intern(const Key &key, Build build) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto entry = mShapes.emplace(key, std::weak_ptr<const Shape>()).first;
+    auto shape = entry->second.lock();
+    if (shape != nullptr) {
+        return std::static_pointer_cast<const T>(shape);
+    }
+
+    std::shared_ptr<const T> created(build());
+    // derived data is built here, once, rather than by the first world using the shape
+    created->prepare();
+    entry->second = created;
+
+    // the keys of freed shapes are swept one neighbour at a time as new shapes come in
+    auto next = std::next(entry);
+    if (next != mShapes.end() && next->second.expired()) {
+        mShapes.erase(next);
+    }
+    return created;
+}
+
+}
@@ -0,0 +1,78 @@
+#ifndef COWPHYS_SHAPEREGISTRY_H
+#define COWPHYS_SHAPEREGISTRY_H
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "BoxShape.h"
+#include "CompShape.h"
+#include "MeshShape.h"
+
+namespace cp {
+
+struct CompPart {
+    std::shared_ptr<const Shape> shape;
+    Vec3U position;
+};
+
+// Interns shapes by type and parameters, asking twice for the same box returns the same instance,
+// so the spheres, tree and bounds of a shape exist once however many bodies use it. The registry
+// only keeps weak references, a shape is freed with the last body or part using it.
+class ShapeRegistry {
+
+public:
+
+    std::shared_ptr<const BoxShape> getBox(const Vec3U &halfSize);
+
+    std::shared_ptr<const BoxShape> getBox(Unit halfX, Unit halfY, Unit halfZ) {
+        return getBox(Vec3U(halfX, halfY, halfZ));
+    }
+
+    // Parts are told apart by instance, intern them first so equal compounds share one shape
+    std::shared_ptr<const CompShape> getComp(const std::vector<CompPart> &parts);
+
+    // Meshes are looked up by a hash of their triangles, which are only compared on a hash hit. The
+    // triangles are kept as given next to the mesh, which rewinds and reorders its own.
+    std::shared_ptr<const MeshShape> getMesh(const std::vector<TriangleU> &triangles);
+
+    // Number of distinct shapes still in use
+    size_t size();
+
+private:
+
+    enum class ShapeKind : Unit {
+        Box,
+        Comp
+    };
+
+    typedef std::vector<Unit> Key;
+
+    struct MeshEntry {
+        std::weak_ptr<const MeshShape> mesh;
+        std::vector<TriangleU> triangles;
+    };
+
+    template<class T, class Build>
+    std::shared_ptr<const T> intern(const Key &key, Build build);
+
+    static void appendVec(Key &key, const Vec3U &vec) {
+        key.push_back(vec.x);
+        key.push_back(vec.y);
+        key.push_back(vec.z);
+    }
+
+    static uint64_t hashTriangles(const std::vector<TriangleU> &triangles);
+
+    static bool sameTriangles(const std::vector<TriangleU> &left, const std::vector<TriangleU> &right);
+
+    std::mutex mMutex;
+    std::map<Key, std::weak_ptr<const Shape>> mShapes;
+    std::unordered_multimap<uint64_t, MeshEntry> mMeshes;
+
+};
+
+}
+
+#endif //COWPHYS_SHAPEREGISTRY_H
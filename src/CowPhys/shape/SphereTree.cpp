@@ -0,0 +1,87 @@
+#include "SphereTree.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace cp {
+
+void SphereTree::build(std::vector<SphereU> &spheres) {
+    mNodes.clear();
+    mExternalNodes = ArrayView<SphereTreeNode>();
+    if (spheres.empty()) {
+        return;
+    }
+
+    mNodes.reserve(spheres.size() / 2 + 1);
+    buildNode(spheres, 0, spheres.size(), 0);
+}
+
+int32_t SphereTree::buildNode(std::vector<SphereU> &spheres, size_t start, size_t end, int depth) {
+    auto index = static_cast<int32_t>(mNodes.size());
+    mNodes.emplace_back();
+
+    Vec3U min(std::numeric_limits<Unit>::max());
+    Vec3U max(std::numeric_limits<Unit>::min());
+    for (size_t i = start; i < end; ++i) {
+        Vec3U radius(spheres[i].getRadius());
+        min = min.min(spheres[i].getPosition() - radius);
+        max = max.max(spheres[i].getPosition() + radius);
+    }
+
+    // the bounds are centered on the box and rounded up so they always enclose the children
+    Vec3U center = min + (max - min) / 2;
+    double reach = 0;
+    for (size_t i = start; i < end; ++i) {
+        auto offset = spheres[i].getPosition() - center;
+        double distance = std::sqrt(static_cast<double>(offset.x) * offset.x +
+                                    static_cast<double>(offset.y) * offset.y +
+                                    static_cast<double>(offset.z) * offset.z);
+        reach = std::max(reach, distance + static_cast<double>(spheres[i].getRadius()));
+    }
+
+    SphereTreeNode node{};
+    node.bounds = SphereU(center, static_cast<Unit>(std::ceil(reach)) + 1);
+
+    if (end - start <= MaxLeafSize || depth >= MaxDepth) {
+        node.start = static_cast<int32_t>(start);
+        node.count = static_cast<int32_t>(end - start);
+        mNodes[index] = node;
+        return index;
+    }
+
+    auto extent = max - min;
+    int axis = 0;
+    if (extent.y > extent[axis]) {
+        axis = 1;
+    }
+    if (extent.z > extent[axis]) {
+        axis = 2;
+    }
+
+    auto middle = start + (end - start) / 2;
+    std::nth_element(spheres.begin() + start, spheres.begin() + middle, spheres.begin() + end,
+                     [axis](const SphereU &left, const SphereU &right) {
+                         auto leftPos = left.getPosition();
+                         auto rightPos = right.getPosition();
+                         if (leftPos[axis] != rightPos[axis]) {
+                             return leftPos[axis] < rightPos[axis];
+                         }
+                         if (leftPos.x != rightPos.x) {
+                             return leftPos.x < rightPos.x;
+                         }
+                         if (leftPos.y != rightPos.y) {
+                             return leftPos.y < rightPos.y;
+                         }
+                         if (leftPos.z != rightPos.z) {
+                             return leftPos.z < rightPos.z;
+                         }
+                         return left.getRadius() < right.getRadius();
+                     });
+
+    node.left = buildNode(spheres, start, middle, depth + 1);
+    node.right = buildNode(spheres, middle, end, depth + 1);
+    mNodes[index] = node;
+    return index;
+}
+
+}
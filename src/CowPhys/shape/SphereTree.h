@@ -0,0 +1,60 @@
+#ifndef COWPHYS_SPHERETREE_H
+#define COWPHYS_SPHERETREE_H
+
+#include <cstdint>
+#include <vector>
+#include "CowPhys/ArrayView.h"
+#include "CowPhys/math/Sphere.h"
+
+namespace cp {
+
+struct SphereTreeNode {
+    SphereU bounds;
+    int32_t left;
+    int32_t right;
+    int32_t start;
+    int32_t count;
+
+    bool isLeaf() const {
+        return count > 0;
+    }
+};
+
+// Binary tree of bounding spheres over the spheres of a shape, nodes are stored depth first
+// so the root is always the first node. Building reorders the spheres so every leaf covers a
+// contiguous range of them.
+class SphereTree {
+
+public:
+
+    static constexpr int MaxLeafSize = 8;
+    static constexpr int MaxDepth = 32;
+
+    void build(std::vector<SphereU> &spheres);
+
+    ArrayView<SphereTreeNode> getNodes() const {
+        return mNodes.empty() ? mExternalNodes : ArrayView<SphereTreeNode>(mNodes);
+    }
+
+    bool empty() const {
+        return getNodes().empty();
+    }
+
+    // Uses nodes built elsewhere, like in a cooked asset, instead of building them
+    void view(ArrayView<SphereTreeNode> nodes) {
+        mNodes.clear();
+        mExternalNodes = nodes;
+    }
+
+private:
+
+    int32_t buildNode(std::vector<SphereU> &spheres, size_t start, size_t end, int depth);
+
+    std::vector<SphereTreeNode> mNodes;
+    ArrayView<SphereTreeNode> mExternalNodes;
+
+};
+
+}
+
+#endif //COWPHYS_SPHERETREE_H
@@ -0,0 +1,172 @@
+#include "TriangleTree.h"
+#include <algorithm>
+#include <limits>
+#include "CowPhys/profile/Profiler.h"
+
+namespace cp {
+
+namespace {
+
+Vec3U centroid(const TriangleU &triangle) {
+    return (triangle.p0 + triangle.p1 + triangle.p2) / 3;
+}
+
+}
+
+void TriangleTree::build(std::vector<TriangleU> &triangles) {
+    mNodes.clear();
+    mExternalNodes = ArrayView<TriangleTreeNode>();
+    if (triangles.empty()) {
+        return;
+    }
+
+    mNodes.reserve(triangles.size() / 2 + 1);
+    buildNode(triangles, 0, triangles.size(), 0);
+}
+
+int32_t TriangleTree::buildNode(std::vector<TriangleU> &triangles, size_t start, size_t end, int depth) {
+    auto index = static_cast<int32_t>(mNodes.size());
+    mNodes.emplace_back();
+
+    TriangleTreeNode node{};
+    node.min = Vec3U(std::numeric_limits<Unit>::max());
+    node.max = Vec3U(std::numeric_limits<Unit>::min());
+    Vec3U centerMin = node.min;
+    Vec3U centerMax = node.max;
+    for (size_t i = start; i < end; ++i) {
+        auto &triangle = triangles[i];
+        node.min = node.min.min(triangle.p0).min(triangle.p1).min(triangle.p2);
+        node.max = node.max.max(triangle.p0).max(triangle.p1).max(triangle.p2);
+        auto center = centroid(triangle);
+        centerMin = centerMin.min(center);
+        centerMax = centerMax.max(center);
+    }
+
+    if (end - start <= MaxLeafSize || depth >= MaxDepth) {
+        node.start = static_cast<int32_t>(start);
+        node.count = static_cast<int32_t>(end - start);
+        mNodes[index] = node;
+        return index;
+    }
+
+    // split on the axis the centroids spread the most along, big triangles do not skew it
+    auto extent = centerMax - centerMin;
+    int axis = 0;
+    if (extent.y > extent[axis]) {
+        axis = 1;
+    }
+    if (extent.z > extent[axis]) {
+        axis = 2;
+    }
+
+    auto middle = start + (end - start) / 2;
+    std::nth_element(triangles.begin() + start, triangles.begin() + middle, triangles.begin() + end,
+                     [axis](const TriangleU &left, const TriangleU &right) {
+                         auto leftCenter = centroid(left);
+                         auto rightCenter = centroid(right);
+                         if (leftCenter[axis] != rightCenter[axis]) {
+                             return leftCenter[axis] < rightCenter[axis];
+                         }
+                         if (leftCenter.x != rightCenter.x) {
+                             return leftCenter.x < rightCenter.x;
+                         }
+                         if (leftCenter.y != rightCenter.y) {
+                             return leftCenter.y < rightCenter.y;
+                         }
+                         return leftCenter.z < rightCenter.z;
+                     });
+
+    node.left = buildNode(triangles, start, middle, depth + 1);
+    node.right = buildNode(triangles, middle, end, depth + 1);
+    mNodes[index] = node;
+    return index;
+}
+
+bool TriangleTree::raycast(ArrayView<TriangleU> triangles, const double pos[3], const double dir[3],
+                           Unit &t, int32_t *triangle, bool anyHit) const {
+    auto nodes = getNodes();
+    if (nodes.empty()) {
+        return false;
+    }
+
+    bool found = false;
+    int32_t stack[MaxDepth * 2 + 2];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0) {
+        auto &node = nodes[stack[--stackSize]];
+        COWPHYS_PROFILE_COUNT(nodeVisits, 1);
+        double enter;
+        if (!rayEnters(node, pos, dir, t, enter)) {
+            continue;
+        }
+
+        if (node.isLeaf()) {
+            for (int32_t i = node.start; i < node.start + node.count; ++i) {
+                double hit;
+                if (!triangles[i].raycast(pos, dir, hit)) {
+                    continue;
+                }
+                auto current = static_cast<Unit>(hit);
+                if (current < t) {
+                    t = current;
+                    found = true;
+                    if (triangle != nullptr) {
+                        *triangle = i;
+                    }
+                    if (anyHit) {
+                        return true;
+                    }
+                }
+            }
+            continue;
+        }
+
+        // nearest child last so it is popped first and tightens t for the other one
+        double enterLeft, enterRight;
+        bool hitLeft = rayEnters(nodes[node.left], pos, dir, t, enterLeft);
+        bool hitRight = rayEnters(nodes[node.right], pos, dir, t, enterRight);
+        if (hitLeft && hitRight) {
+            bool leftFirst = enterLeft <= enterRight;
+            stack[stackSize++] = leftFirst ? node.right : node.left;
+            stack[stackSize++] = leftFirst ? node.left : node.right;
+        } else if (hitLeft) {
+            stack[stackSize++] = node.left;
+        } else if (hitRight) {
+            stack[stackSize++] = node.right;
+        }
+    }
+
+    return found;
+}
+
+bool TriangleTree::rayEnters(const TriangleTreeNode &node, const double pos[3], const double dir[3], Unit t,
+                             double &enter) {
+    double near = 0;
+    double far = static_cast<double>(t) + 1;
+    for (int i = 0; i < 3; ++i) {
+        if (dir[i] == 0) {
+            if (pos[i] < node.min[i] || pos[i] > node.max[i]) {
+                return false;
+            }
+            continue;
+        }
+
+        double inverse = 1.0 / dir[i];
+        double first = (static_cast<double>(node.min[i]) - pos[i]) * inverse;
+        double second = (static_cast<double>(node.max[i]) - pos[i]) * inverse;
+        if (first > second) {
+            std::swap(first, second);
+        }
+        near = std::max(near, first);
+        far = std::min(far, second);
+        if (near > far) {
+            return false;
+        }
+    }
+
+    enter = near;
+    return true;
+}
+
+}
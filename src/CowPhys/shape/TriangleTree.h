@@ -0,0 +1,85 @@
+#ifndef COWPHYS_TRIANGLETREE_H
+#define COWPHYS_TRIANGLETREE_H
+
+#include <cstdint>
+#include <vector>
+#include "CowPhys/ArrayView.h"
+#include "CowPhys/math/Triangle.h"
+
+namespace cp {
+
+struct TriangleTreeNode {
+    Vec3U min;
+    Vec3U max;
+    int32_t left;
+    int32_t right;
+    int32_t start;
+    int32_t count;
+
+    bool isLeaf() const {
+        return count > 0;
+    }
+};
+
+// Box tree over the triangles of a mesh, laid out like SphereTree: nodes depth first with the root
+// first, building reorders the triangles so every leaf covers a contiguous range of them.
+class TriangleTree {
+
+public:
+
+    static constexpr int MaxLeafSize = 4;
+    static constexpr int MaxDepth = 48;
+
+    void build(std::vector<TriangleU> &triangles);
+
+    ArrayView<TriangleTreeNode> getNodes() const {
+        return mNodes.empty() ? mExternalNodes : ArrayView<TriangleTreeNode>(mNodes);
+    }
+
+    bool empty() const {
+        return getNodes().empty();
+    }
+
+    // Uses nodes built elsewhere, like in a cooked asset, instead of building them
+    void view(ArrayView<TriangleTreeNode> nodes) {
+        mNodes.clear();
+        mExternalNodes = nodes;
+    }
+
+    // Lowers t to the closest triangle hit closer than t and returns true, triangle receives its
+    // index. With anyHit the first hit closer than t ends the search. The ray is given in doubles
+    // so rotating it into mesh space does not round it.
+    bool raycast(ArrayView<TriangleU> triangles, const double pos[3], const double dir[3], Unit &t,
+                 int32_t *triangle = nullptr, bool anyHit = false) const;
+
+    // Squared distance from a point to the box of a node, zero inside it
+    static double distanceSquared(const TriangleTreeNode &node, const Vec3U &point) {
+        double total = 0;
+        for (int i = 0; i < 3; ++i) {
+            double offset = 0;
+            if (point[i] < node.min[i]) {
+                offset = static_cast<double>(node.min[i] - point[i]);
+            } else if (point[i] > node.max[i]) {
+                offset = static_cast<double>(point[i] - node.max[i]);
+            }
+            total += offset * offset;
+        }
+        return total;
+    }
+
+private:
+
+    int32_t buildNode(std::vector<TriangleU> &triangles, size_t start, size_t end, int depth);
+
+    // Distance along the ray to the box of a node, false when the ray misses it or enters past t
+    static bool rayEnters(const TriangleTreeNode &node, const double pos[3], const double dir[3], Unit t,
+                          double &enter);
+
+    std::vector<TriangleTreeNode> mNodes;
+    ArrayView<TriangleTreeNode> mExternalNodes;
+
+};
+
+}
+
+#endif //COWPHYS_TRIANGLETREE_H
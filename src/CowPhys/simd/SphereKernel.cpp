@@ -0,0 +1,201 @@
+#include "SphereKernel.h"
+#include <cmath>
+#include <limits>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define COWPHYS_SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace cp {
+
+namespace {
+
+SphereHit deepestScalar(const SphereU &sphere, const SphereArrays &arrays, int32_t start, int32_t count) {
+    SphereHit hit{-1, std::numeric_limits<Unit>::min()};
+    auto pos = sphere.getPosition();
+    double x = static_cast<double>(pos.x);
+    double y = static_cast<double>(pos.y);
+    double z = static_cast<double>(pos.z);
+    double radius = static_cast<double>(sphere.getRadius());
+    double bestDepth = -std::numeric_limits<double>::infinity();
+
+    for (int32_t i = start; i < start + count; ++i) {
+        double dx = x - arrays.x[i];
+        double dy = y - arrays.y[i];
+        double dz = z - arrays.z[i];
+        double distance = std::trunc(std::sqrt(dx * dx + dy * dy + dz * dz));
+        double radii = radius + arrays.radius[i];
+        if (distance < radii && radii - distance > bestDepth) {
+            bestDepth = radii - distance;
+            hit.index = i;
+        }
+    }
+
+    if (hit.index >= 0) {
+        hit.depth = static_cast<Unit>(bestDepth);
+    }
+    return hit;
+}
+
+#ifdef COWPHYS_SIMD_X86
+
+// Folds the per lane winners, then finishes the range the vectors did not cover
+SphereHit finish(const double *depths, const int64_t *indices, int lanes, const SphereU &sphere,
+                 const SphereArrays &arrays, int32_t tail, int32_t end) {
+    SphereHit hit{-1, std::numeric_limits<Unit>::min()};
+    double bestDepth = -std::numeric_limits<double>::infinity();
+    for (int lane = 0; lane < lanes; ++lane) {
+        if (indices[lane] < 0) {
+            continue;
+        }
+        if (depths[lane] > bestDepth || (depths[lane] == bestDepth && indices[lane] < hit.index)) {
+            bestDepth = depths[lane];
+            hit.index = static_cast<int32_t>(indices[lane]);
+        }
+    }
+
+    if (tail < end) {
+        auto rest = deepestScalar(sphere, arrays, tail, end - tail);
+        if (rest.index >= 0 && static_cast<double>(rest.depth) > bestDepth) {
+            return rest;
+        }
+    }
+
+    if (hit.index >= 0) {
+        hit.depth = static_cast<Unit>(bestDepth);
+    }
+    return hit;
+}
+
+__attribute__((target("sse4.1")))
+SphereHit deepestSSE4(const SphereU &sphere, const SphereArrays &arrays, int32_t start, int32_t count) {
+    auto pos = sphere.getPosition();
+    __m128d x = _mm_set1_pd(static_cast<double>(pos.x));
+    __m128d y = _mm_set1_pd(static_cast<double>(pos.y));
+    __m128d z = _mm_set1_pd(static_cast<double>(pos.z));
+    __m128d radius = _mm_set1_pd(static_cast<double>(sphere.getRadius()));
+    __m128d bestDepth = _mm_set1_pd(-std::numeric_limits<double>::infinity());
+    __m128i bestIndex = _mm_set1_epi64x(-1);
+    __m128i index = _mm_set_epi64x(start + 1, start);
+    __m128i step = _mm_set1_epi64x(2);
+
+    int32_t end = start + count;
+    int32_t i = start;
+    for (; i + 2 <= end; i += 2) {
+        __m128d dx = _mm_sub_pd(x, _mm_loadu_pd(&arrays.x[i]));
+        __m128d dy = _mm_sub_pd(y, _mm_loadu_pd(&arrays.y[i]));
+        __m128d dz = _mm_sub_pd(z, _mm_loadu_pd(&arrays.z[i]));
+        __m128d squared = _mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)), _mm_mul_pd(dz, dz));
+        __m128d distance = _mm_round_pd(_mm_sqrt_pd(squared), _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+        __m128d radii = _mm_add_pd(radius, _mm_loadu_pd(&arrays.radius[i]));
+        __m128d depth = _mm_sub_pd(radii, distance);
+        __m128d better = _mm_and_pd(_mm_cmplt_pd(distance, radii), _mm_cmpgt_pd(depth, bestDepth));
+        bestDepth = _mm_blendv_pd(bestDepth, depth, better);
+        bestIndex = _mm_castpd_si128(_mm_blendv_pd(_mm_castsi128_pd(bestIndex), _mm_castsi128_pd(index), better));
+        index = _mm_add_epi64(index, step);
+    }
+
+    alignas(16) double depths[2];
+    alignas(16) int64_t indices[2];
+    _mm_store_pd(depths, bestDepth);
+    _mm_store_si128(reinterpret_cast<__m128i *>(indices), bestIndex);
+    return finish(depths, indices, 2, sphere, arrays, i, end);
+}
+
+__attribute__((target("avx2")))
+SphereHit deepestAVX2(const SphereU &sphere, const SphereArrays &arrays, int32_t start, int32_t count) {
+    auto pos = sphere.getPosition();
+    __m256d x = _mm256_set1_pd(static_cast<double>(pos.x));
+    __m256d y = _mm256_set1_pd(static_cast<double>(pos.y));
+    __m256d z = _mm256_set1_pd(static_cast<double>(pos.z));
+    __m256d radius = _mm256_set1_pd(static_cast<double>(sphere.getRadius()));
+    __m256d bestDepth = _mm256_set1_pd(-std::numeric_limits<double>::infinity());
+    __m256i bestIndex = _mm256_set1_epi64x(-1);
+    __m256i index = _mm256_set_epi64x(start + 3, start + 2, start + 1, start);
+    __m256i step = _mm256_set1_epi64x(4);
+
+    int32_t end = start + count;
+    int32_t i = start;
+    for (; i + 4 <= end; i += 4) {
+        __m256d dx = _mm256_sub_pd(x, _mm256_loadu_pd(&arrays.x[i]));
+        __m256d dy = _mm256_sub_pd(y, _mm256_loadu_pd(&arrays.y[i]));
+        __m256d dz = _mm256_sub_pd(z, _mm256_loadu_pd(&arrays.z[i]));
+        __m256d squared = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)),
+                                        _mm256_mul_pd(dz, dz));
+        __m256d distance = _mm256_round_pd(_mm256_sqrt_pd(squared), _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+        __m256d radii = _mm256_add_pd(radius, _mm256_loadu_pd(&arrays.radius[i]));
+        __m256d depth = _mm256_sub_pd(radii, distance);
+        __m256d better = _mm256_and_pd(_mm256_cmp_pd(distance, radii, _CMP_LT_OQ),
+                                       _mm256_cmp_pd(depth, bestDepth, _CMP_GT_OQ));
+        bestDepth = _mm256_blendv_pd(bestDepth, depth, better);
+        bestIndex = _mm256_castpd_si256(_mm256_blendv_pd(_mm256_castsi256_pd(bestIndex),
+                                                         _mm256_castsi256_pd(index), better));
+        index = _mm256_add_epi64(index, step);
+    }
+
+    alignas(32) double depths[4];
+    alignas(32) int64_t indices[4];
+    _mm256_store_pd(depths, bestDepth);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(indices), bestIndex);
+    return finish(depths, indices, 4, sphere, arrays, i, end);
+}
+
+#endif
+
+SimdLevel detectLevel() {
+#ifdef COWPHYS_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return SimdLevel::AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return SimdLevel::SSE4;
+    }
+#endif
+    return SimdLevel::Scalar;
+}
+
+}
+
+SimdLevel SphereKernel::sLevel = SimdLevel::Scalar;
+SphereKernel::Function SphereKernel::sFunction = deepestScalar;
+
+namespace {
+
+// selects the best implementation before main runs
+struct KernelSelector {
+    KernelSelector() {
+        SphereKernel::setLevel(SphereKernel::getSupportedLevel());
+    }
+} sKernelSelector;
+
+}
+
+SimdLevel SphereKernel::getSupportedLevel() {
+    static SimdLevel supported = detectLevel();
+    return supported;
+}
+
+void SphereKernel::setLevel(SimdLevel level) {
+    if (static_cast<int>(level) > static_cast<int>(getSupportedLevel())) {
+        level = getSupportedLevel();
+    }
+
+    sLevel = level;
+    switch (level) {
+#ifdef COWPHYS_SIMD_X86
+        case SimdLevel::AVX2:
+            sFunction = deepestAVX2;
+            break;
+        case SimdLevel::SSE4:
+            sFunction = deepestSSE4;
+            break;
+#endif
+        default:
+            sFunction = deepestScalar;
+            break;
+    }
+}
+
+}
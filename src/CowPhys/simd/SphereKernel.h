@@ -0,0 +1,81 @@
+#ifndef COWPHYS_SPHEREKERNEL_H
+#define COWPHYS_SPHEREKERNEL_H
+
+#include <cstdint>
+#include <vector>
+#include "CowPhys/math/Sphere.h"
+
+namespace cp {
+
+// World space spheres stored as one array per component. Units are stored as doubles, which is
+// exact for every coordinate below 2^53.
+struct SphereArrays {
+    std::vector<double> x;
+    std::vector<double> y;
+    std::vector<double> z;
+    std::vector<double> radius;
+
+    void resize(size_t size) {
+        x.resize(size);
+        y.resize(size);
+        z.resize(size);
+        radius.resize(size);
+    }
+
+    void set(size_t index, const SphereU &sphere) {
+        auto pos = sphere.getPosition();
+        x[index] = static_cast<double>(pos.x);
+        y[index] = static_cast<double>(pos.y);
+        z[index] = static_cast<double>(pos.z);
+        radius[index] = static_cast<double>(sphere.getRadius());
+    }
+
+    size_t size() const {
+        return x.size();
+    }
+};
+
+struct SphereHit {
+    int32_t index;
+    Unit depth;
+};
+
+enum class SimdLevel {
+    Scalar,
+    SSE4,
+    AVX2
+};
+
+// Tests one sphere against a range of spheres and returns the deepest penetration, the lowest
+// index wins ties. Every implementation runs the exact same sequence of IEEE operations as
+// Sphere::collides and Sphere::penetration, so they all return the same hit.
+class SphereKernel {
+
+public:
+
+    static SphereHit deepest(const SphereU &sphere, const SphereArrays &arrays, int32_t start, int32_t count) {
+        return sFunction(sphere, arrays, start, count);
+    }
+
+    // Best level supported by the running CPU
+    static SimdLevel getSupportedLevel();
+
+    static SimdLevel getLevel() {
+        return sLevel;
+    }
+
+    // Forces a level, mostly to compare implementations, levels above the supported one are clamped
+    static void setLevel(SimdLevel level);
+
+private:
+
+    typedef SphereHit (*Function)(const SphereU &, const SphereArrays &, int32_t, int32_t);
+
+    static SimdLevel sLevel;
+    static Function sFunction;
+
+};
+
+}
+
+#endif //COWPHYS_SPHEREKERNEL_H
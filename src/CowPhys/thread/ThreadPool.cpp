@@ -0,0 +1,103 @@
+#include "ThreadPool.h"
+#include <atomic>
+
+namespace cp {
+
+ThreadPool::ThreadPool(int threadCount) : mJob(nullptr), mGeneration(0), mPending(0), mStopping(false) {
+    for (int i = 1; i < threadCount; ++i) {
+        mWorkers.emplace_back(&ThreadPool::workerLoop, this, static_cast<size_t>(i));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mWake.notify_all();
+    for (auto &worker: mWorkers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t, size_t)> &task) {
+    if (count == 0) {
+        return;
+    }
+
+    auto threads = static_cast<size_t>(getThreadCount());
+    if (threads == 1 || count == 1) {
+        task(0, count);
+        return;
+    }
+
+    run([&task, count, threads](size_t worker) {
+        size_t begin = count * worker / threads;
+        size_t end = count * (worker + 1) / threads;
+        if (begin < end) {
+            task(begin, end);
+        }
+    });
+}
+
+void ThreadPool::parallelEach(size_t count, const std::function<void(size_t)> &task) {
+    if (count == 0) {
+        return;
+    }
+
+    if (getThreadCount() == 1 || count == 1) {
+        for (size_t i = 0; i < count; ++i) {
+            task(i);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    run([&task, &next, count](size_t) {
+        for (size_t i = next++; i < count; i = next++) {
+            task(i);
+        }
+    });
+}
+
+void ThreadPool::run(const std::function<void(size_t)> &job) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mJob = &job;
+        mPending = mWorkers.size();
+        ++mGeneration;
+    }
+    mWake.notify_all();
+
+    job(0);
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    mDone.wait(lock, [this] { return mPending == 0; });
+    mJob = nullptr;
+}
+
+void ThreadPool::workerLoop(size_t worker) {
+    size_t generation = 0;
+    while (true) {
+        const std::function<void(size_t)> *job;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mWake.wait(lock, [this, generation] { return mStopping || mGeneration != generation; });
+            if (mStopping) {
+                return;
+            }
+            generation = mGeneration;
+            job = mJob;
+        }
+
+        (*job)(worker);
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            --mPending;
+        }
+        mDone.notify_one();
+    }
+}
+
+}
@@ -0,0 +1,56 @@
+#ifndef COWPHYS_THREADPOOL_H
+#define COWPHYS_THREADPOOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cp {
+
+// Fixed set of worker threads running blocking parallel loops. The calling thread takes part in
+// every loop, so a pool of one thread never spawns anything.
+class ThreadPool {
+
+public:
+
+    explicit ThreadPool(int threadCount = 1);
+
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // Splits [0, count) in one contiguous range per thread and returns once every range is done.
+    // The ranges only depend on count and the thread count.
+    void parallelFor(size_t count, const std::function<void(size_t begin, size_t end)> &task);
+
+    // Runs task(i) for every i in [0, count), items are handed out one at a time to balance uneven work
+    void parallelEach(size_t count, const std::function<void(size_t index)> &task);
+
+    int getThreadCount() const {
+        return static_cast<int>(mWorkers.size()) + 1;
+    }
+
+private:
+
+    void workerLoop(size_t worker);
+
+    void run(const std::function<void(size_t worker)> &job);
+
+    std::vector<std::thread> mWorkers;
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    std::condition_variable mDone;
+    const std::function<void(size_t)> *mJob;
+    size_t mGeneration;
+    size_t mPending;
+    bool mStopping;
+
+};
+
+}
+
+#endif //COWPHYS_THREADPOOL_H
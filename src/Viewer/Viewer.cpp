@@ -23,7 +23,7 @@ Viewer::Viewer() : mWorld() {
 
     //auto a = mWorld.createDynBody(new cp::BoxShape(50, 50, 50), cp::Vec3U(0, 2, 0));
     //auto b = mWorld.createDynBody(new cp::BoxShape(.5, .5, .5), cp::Vec3d(0.01, 4, 0));
-    auto c = mWorld.createStaticBody(new cp::BoxShape(500, 50, 500), cp::Vec3U());
+    auto c = mWorld.createStaticBody(mShapes.getBox(500, 50, 500), cp::Vec3U());
 
 
     /*auto subOne = new cp::BoxShape(.2, .2, .2);
@@ -51,22 +51,19 @@ void Viewer::update() {
     mWorld.update();
 
     if (IsKeyPressed(KEY_Q)) {
-        auto body = mWorld.createDynBody(new cp::BoxShape(50, 50, 50), cp::Vec3U(-300, 150, 0));
+        auto body = mWorld.createDynBody(mShapes.getBox(50, 50, 50), cp::Vec3U(-300, 150, 0));
         body->applyForce(cp::Vec3U(70, 0, 0));
     }
 
     if (IsKeyPressed(KEY_W)) {
-        auto body = mWorld.createDynBody(new cp::BoxShape(50, 50, 50), cp::Vec3U(300, 150, 0));
+        auto body = mWorld.createDynBody(mShapes.getBox(50, 50, 50), cp::Vec3U(300, 150, 0));
         body->setRotation(cp::Vec3Small(0, 40, 40));
         body->applyForce(cp::Vec3U(-70, 0, 0));
     }
 
     if (IsKeyPressed(KEY_E)) {
-        auto subOne = new cp::BoxShape(20, 20, 20);
-        auto subTwo = new cp::BoxShape(20, 20, 20);
-        auto comp = new cp::CompShape();
-        comp->addShape(subOne, cp::Vec3U());
-        comp->addShape(subTwo, cp::Vec3U(100, 100, 100));
+        auto sub = mShapes.getBox(20, 20, 20);
+        auto comp = mShapes.getComp({{sub, cp::Vec3U()}, {sub, cp::Vec3U(100, 100, 100)}});
         mWorld.createDynBody(comp, cp::Vec3U(0, 300, 0));
     }
 }
@@ -98,9 +95,7 @@ void Viewer::draw() {
 void Viewer::drawBody(cp::Body *body, Color color) {
 
     if (IsKeyDown(KEY_LEFT_SHIFT)) {
-        for (auto sphere: body->getShape()->getSpheres()) {
-            sphere.rotateBy(body->getRotation().to<cp::Unit>());
-            sphere.moveBy(body->getPos());
+        for (auto sphere: body->getWorldSpheres()) {
             DrawSphere(ViewerHelper::vec3ToVec3(sphere.getPosition()),
                        static_cast<float>(sphere.getRadius()) / 100.f, BLUE);
         }
@@ -137,8 +132,8 @@ void Viewer::drawBody(cp::Body *body, Color color) {
 
     // Draw at the origin (since we already translated to the body's position)
 
-    cp::Shape *shape = body->getShape();
-    auto boxShape = dynamic_cast<cp::BoxShape *>(shape);
+    const cp::Shape *shape = body->getShape();
+    auto boxShape = dynamic_cast<const cp::BoxShape *>(shape);
     if (boxShape != nullptr) {
         Vector3 halfSize = ViewerHelper::vec3ToVec3(boxShape->getHalfSize());
         DrawCube((Vector3) {0, 0, 0},
@@ -147,7 +142,7 @@ void Viewer::drawBody(cp::Body *body, Color color) {
                  halfSize.z * 2, color);
     }
 
-    auto meshShape = dynamic_cast<cp::MeshShape *>(shape);
+    auto meshShape = dynamic_cast<const cp::MeshShape *>(shape);
     if (meshShape != nullptr) {
         for (auto triangle: meshShape->getTriangles()) {
             Vector3 p0 = ViewerHelper::vec3ToVec3(triangle.p0);
@@ -157,10 +152,10 @@ void Viewer::drawBody(cp::Body *body, Color color) {
         }
     }
 
-    auto compShape = dynamic_cast<cp::CompShape *>(shape);
+    auto compShape = dynamic_cast<const cp::CompShape *>(shape);
     if (compShape != nullptr) {
         for (auto comp: compShape->getComposition()) {
-            auto subBox = dynamic_cast<cp::BoxShape *>(comp.shape);
+            auto subBox = dynamic_cast<const cp::BoxShape *>(comp.shape.get());
             if (subBox != nullptr) {
                 Vector3 halfSize = ViewerHelper::vec3ToVec3(subBox->getHalfSize());
                 DrawCube(ViewerHelper::vec3ToVec3(comp.position),
@@ -3,6 +3,7 @@
 
 #include <raylib.h>
 #include "CowPhys/PhysWorld.h"
+#include "CowPhys/shape/ShapeRegistry.h"
 
 namespace viewer {
 
@@ -24,6 +25,7 @@ private:
     void drawBody(cp::Body *body, Color color);
 
 
+    cp::ShapeRegistry mShapes;
     cp::PhysWorld mWorld;
     Camera3D mCamera;
 